@@ -0,0 +1,469 @@
+#ifndef _OMS_COMPRESS_TFTP_COMPRESS_H
+#define _OMS_COMPRESS_TFTP_COMPRESS_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <sys/stat.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "msg/TFTPOption.h"
+
+namespace oms
+{
+    namespace compress
+    {
+        class ICompressor
+        {
+        public:
+            virtual ~ICompressor() {}
+            virtual const char *Name() const = 0;
+            virtual uint32_t Bound(uint32_t len) const = 0;
+            virtual int32_t Compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen) const = 0;
+            virtual int32_t Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen) const = 0;
+        };
+
+        class ZlibCompressor : public ICompressor
+        {
+            int m_level;
+
+        public:
+            ZlibCompressor(int level = Z_DEFAULT_COMPRESSION) : m_level(level)
+            {
+            }
+
+            const char *Name() const
+            {
+                return "zlib";
+            }
+            uint32_t Bound(uint32_t len) const
+            {
+                return compressBound(len);
+            }
+            int32_t Compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen) const
+            {
+                uLongf out = dstLen;
+                if (!src || !dst || compress2(dst, &out, src, srcLen, m_level) != Z_OK)
+                    return -1;
+                return out;
+            }
+            int32_t Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen) const
+            {
+                uLongf out = dstLen;
+                if (!src || !dst || uncompress(dst, &out, src, srcLen) != Z_OK)
+                    return -1;
+                return out;
+            }
+        };
+
+        class TFTPCompressors
+        {
+            std::list<const ICompressor *> m_codecs;
+
+            TFTPCompressors(const TFTPCompressors &);
+            TFTPCompressors &operator=(const TFTPCompressors &);
+
+        public:
+            TFTPCompressors() {}
+
+            // codecs are not owned and must outlive the registry
+            void Register(const ICompressor *codec)
+            {
+                if (codec && !Find(codec->Name()))
+                    m_codecs.push_back(codec);
+            }
+            const ICompressor *Find(const char *name) const
+            {
+                for (std::list<const ICompressor *>::const_iterator it = m_codecs.begin(); it != m_codecs.end(); it++)
+                {
+                    if (!strcasecmp(name, (*it)->Name()))
+                        return *it;
+                }
+                return NULL;
+            }
+
+            // The client offers a comma separated preference list, e.g. "zlib,lz4".
+            // The first codec we support is echoed back in the OACK; when nothing
+            // matches the option is left out of the OACK and the transfer is plain.
+            const ICompressor *Negotiate(const msg::TFTPOpts &req, msg::TFTPOpts &oack) const
+            {
+                msg::TFTPOpts::const_iterator it = req.find(TFTP_OPT_COMPRESS);
+                if (it == req.end())
+                    return NULL;
+
+                std::string offer(it->Value());
+                size_t pos = 0;
+                while (pos <= offer.length())
+                {
+                    size_t end = offer.find(',', pos);
+                    if (end == std::string::npos)
+                        end = offer.length();
+
+                    std::string name = offer.substr(pos, end - pos);
+                    const ICompressor *codec = name.empty() ? NULL : Find(name.c_str());
+                    if (codec)
+                    {
+                        oack.insert(TFTP_OPT_COMPRESS, codec->Name());
+                        return codec;
+                    }
+                    pos = end + 1;
+                }
+                return NULL;
+            }
+        };
+
+        // A compressed image is the file cut into chunks of chunkSize raw bytes,
+        // each compressed on its own and framed as
+        //
+        //  4 bytes   4 bytes        n bytes     pad
+        // +--------+--------------+-----------+-------+
+        // | rawLen | flag|dataLen | chunk     | 0...0 |
+        // +--------+--------------+-----------+-------+
+        //
+        // and zero padded up to the next block boundary, so every chunk starts
+        // on a DATA block of its own. The last chunk is not padded. The high
+        // bit of the second word marks a chunk that did not shrink and is
+        // stored as is.
+        class TFTPCompressedImage
+        {
+        public:
+            enum
+            {
+                FRAME_HEADER_LENGTH = 8,
+                FRAME_STORED = 0x80000000u,
+            };
+
+        private:
+            std::vector<uint8_t> m_data;
+            uint64_t m_rawSize;
+            uint16_t m_blkSize;
+
+            TFTPCompressedImage(const TFTPCompressedImage &);
+            TFTPCompressedImage &operator=(const TFTPCompressedImage &);
+
+        public:
+            TFTPCompressedImage() : m_rawSize(0), m_blkSize(0)
+            {
+            }
+
+            int32_t Build(const ICompressor &codec, const uint8_t *raw, uint64_t rawLen,
+                          uint16_t blkSize, uint32_t chunkSize)
+            {
+                if ((!raw && rawLen) || !blkSize || !chunkSize || chunkSize >= FRAME_STORED)
+                    return -1;
+
+                m_data.clear();
+                m_rawSize = rawLen;
+                m_blkSize = blkSize;
+
+                std::vector<uint8_t> scratch(codec.Bound(chunkSize));
+                for (uint64_t off = 0; off < rawLen; off += chunkSize)
+                {
+                    uint32_t n = (rawLen - off < chunkSize) ? (uint32_t)(rawLen - off) : chunkSize;
+                    int32_t ret = codec.Compress(raw + off, n, &scratch[0], scratch.size());
+                    if (ret < 0)
+                        return -1;
+
+                    const uint8_t *chunk = &scratch[0];
+                    uint32_t flags = 0;
+                    if ((uint32_t)ret >= n)
+                    {
+                        chunk = raw + off;
+                        ret = n;
+                        flags = FRAME_STORED;
+                    }
+
+                    size_t pos = m_data.size();
+                    size_t framed = FRAME_HEADER_LENGTH + ret;
+                    if (off + n < rawLen)
+                        framed = (framed + blkSize - 1) / blkSize * blkSize;
+                    m_data.resize(pos + framed, 0);
+
+                    PutUInt32(&m_data[pos], n);
+                    PutUInt32(&m_data[pos + 4], flags | (uint32_t)ret);
+                    memcpy(&m_data[pos + FRAME_HEADER_LENGTH], chunk, ret);
+                }
+                return 0;
+            }
+
+            // bytes on the wire, this is what tsize reports
+            uint64_t Size() const
+            {
+                return m_data.size();
+            }
+            uint64_t RawSize() const
+            {
+                return m_rawSize;
+            }
+            uint16_t BlkSize() const
+            {
+                return m_blkSize;
+            }
+            // a transfer always ends on a short block, possibly an empty one
+            uint64_t BlockCount() const
+            {
+                return m_blkSize ? m_data.size() / m_blkSize + 1 : 0;
+            }
+            // index is 0 based, DATA block number is (index + 1) & 0xFFFF
+            int32_t Block(uint64_t index, const uint8_t **data) const
+            {
+                if (!data || index >= BlockCount())
+                    return -1;
+
+                uint64_t off = index * m_blkSize;
+                uint64_t left = m_data.size() - off;
+                *data = left ? &m_data[off] : NULL;
+                return left < m_blkSize ? (int32_t)left : m_blkSize;
+            }
+
+            static void PutUInt32(uint8_t *p, uint32_t v)
+            {
+                p[0] = (v >> 24) & 0xFF;
+                p[1] = (v >> 16) & 0xFF;
+                p[2] = (v >> 8) & 0xFF;
+                p[3] = v & 0xFF;
+            }
+            static uint32_t GetUInt32(const uint8_t *p)
+            {
+                return (((uint32_t)p[0]) << 24) | (((uint32_t)p[1]) << 16) |
+                       (((uint32_t)p[2]) << 8) | p[3];
+            }
+        };
+
+        // Receiving side of a compressed transfer: feed it the DATA payloads in
+        // order and it appends the decompressed bytes to Output(). A receiver
+        // that writes them out as they come calls Take() after each Write(),
+        // so no more than a chunk is held however large the image.
+        class TFTPDecompressStream
+        {
+            const ICompressor &m_codec;
+            uint16_t m_blkSize;
+            uint32_t m_maxChunk;
+            std::vector<uint8_t> m_frame;
+            std::vector<uint8_t> m_raw;
+            std::string m_out;
+            uint64_t m_skip;
+
+            TFTPDecompressStream(const TFTPDecompressStream &);
+            TFTPDecompressStream &operator=(const TFTPDecompressStream &);
+
+        public:
+            TFTPDecompressStream(const ICompressor &codec, uint16_t blkSize, uint32_t maxChunk = 1 << 24)
+                : m_codec(codec), m_blkSize(blkSize), m_maxChunk(maxChunk), m_skip(0)
+            {
+            }
+
+            // what was decoded since the last Take()
+            const std::string &Output() const
+            {
+                return m_out;
+            }
+            // hands Output() over to out and starts a new one
+            void Take(std::string &out)
+            {
+                out.clear();
+                out.swap(m_out);
+            }
+            // false while a chunk is only partially received
+            bool Complete() const
+            {
+                return m_frame.empty();
+            }
+
+            int32_t Write(const uint8_t *data, uint32_t len)
+            {
+                if (!m_blkSize || (!data && len))
+                    return -1;
+
+                for (uint32_t off = 0; off < len;)
+                {
+                    if (m_skip)
+                    {
+                        uint32_t n = (len - off < m_skip) ? len - off : (uint32_t)m_skip;
+                        off += n;
+                        m_skip -= n;
+                        continue;
+                    }
+
+                    uint32_t need = TFTPCompressedImage::FRAME_HEADER_LENGTH;
+                    if (m_frame.size() >= need)
+                        need += TFTPCompressedImage::GetUInt32(&m_frame[4]) & ~TFTPCompressedImage::FRAME_STORED;
+
+                    uint32_t n = need - m_frame.size();
+                    if (n > len - off)
+                        n = len - off;
+                    m_frame.insert(m_frame.end(), data + off, data + off + n);
+                    off += n;
+
+                    if (m_frame.size() == TFTPCompressedImage::FRAME_HEADER_LENGTH)
+                    {
+                        uint32_t rawLen = TFTPCompressedImage::GetUInt32(&m_frame[0]);
+                        uint32_t dataLen = TFTPCompressedImage::GetUInt32(&m_frame[4]) & ~TFTPCompressedImage::FRAME_STORED;
+                        if (!rawLen || rawLen > m_maxChunk || dataLen > m_codec.Bound(rawLen))
+                            return -1;
+                        if (dataLen)
+                            continue;
+                    }
+                    if (m_frame.size() >= TFTPCompressedImage::FRAME_HEADER_LENGTH && m_frame.size() == need)
+                    {
+                        if (Flush() < 0)
+                            return -1;
+                    }
+                }
+                return len;
+            }
+
+        private:
+            int32_t Flush()
+            {
+                uint32_t rawLen = TFTPCompressedImage::GetUInt32(&m_frame[0]);
+                uint32_t word = TFTPCompressedImage::GetUInt32(&m_frame[4]);
+                uint32_t dataLen = word & ~TFTPCompressedImage::FRAME_STORED;
+                const uint8_t *chunk = &m_frame[TFTPCompressedImage::FRAME_HEADER_LENGTH];
+
+                if (word & TFTPCompressedImage::FRAME_STORED)
+                {
+                    if (dataLen != rawLen)
+                        return -1;
+                    m_out.append((const char *)chunk, dataLen);
+                }
+                else
+                {
+                    m_raw.resize(rawLen);
+                    if (m_codec.Decompress(chunk, dataLen, &m_raw[0], rawLen) != (int32_t)rawLen)
+                        return -1;
+                    m_out.append((const char *)&m_raw[0], rawLen);
+                }
+
+                uint64_t framed = m_frame.size();
+                m_skip = (framed + m_blkSize - 1) / m_blkSize * m_blkSize - framed;
+                m_frame.clear();
+                return 0;
+            }
+        };
+
+        // Server side cache of compressed images. Entries are keyed by path,
+        // codec and framing, and carry the identity of the source so a stale
+        // image is rebuilt instead of served. Sessions keep their image alive
+        // through the shared pointer even after it is evicted.
+        class TFTPCompressCache
+        {
+        public:
+            typedef std::shared_ptr<const TFTPCompressedImage> image_ptr;
+
+        private:
+            // Size and whole second mtime miss a same size rewrite within a
+            // second. The inode catches a file replaced by rename, the
+            // nanosecond ctime any write or attribute change in place.
+            struct Version
+            {
+                uint64_t size;
+                uint64_t dev;
+                uint64_t ino;
+                int64_t mtimeNs;
+                int64_t ctimeNs;
+
+                Version(const struct stat &st)
+                    : size(st.st_size), dev(st.st_dev), ino(st.st_ino),
+                      mtimeNs((int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec),
+                      ctimeNs((int64_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec)
+                {
+                }
+                bool operator==(const Version &o) const
+                {
+                    return size == o.size && dev == o.dev && ino == o.ino && mtimeNs == o.mtimeNs &&
+                           ctimeNs == o.ctimeNs;
+                }
+            };
+
+            struct Entry
+            {
+                image_ptr image;
+                Version version;
+                std::list<std::string>::iterator lru;
+
+                Entry(const image_ptr &i, const Version &v) : image(i), version(v)
+                {
+                }
+            };
+
+            std::map<std::string, Entry> m_entries;
+            std::list<std::string> m_lru;
+            uint64_t m_capacity;
+            uint64_t m_bytes;
+
+            TFTPCompressCache(const TFTPCompressCache &);
+            TFTPCompressCache &operator=(const TFTPCompressCache &);
+
+        public:
+            TFTPCompressCache(uint64_t capacity) : m_capacity(capacity), m_bytes(0)
+            {
+            }
+
+            uint64_t Bytes() const
+            {
+                return m_bytes;
+            }
+            size_t Count() const
+            {
+                return m_entries.size();
+            }
+
+            // st: a current stat of the source file
+            image_ptr Get(const char *path, const ICompressor &codec, uint16_t blkSize, uint32_t chunkSize,
+                          const struct stat &st)
+            {
+                std::map<std::string, Entry>::iterator it = m_entries.find(Key(path, codec, blkSize, chunkSize));
+                if (it == m_entries.end())
+                    return image_ptr();
+                if (!(it->second.version == Version(st)))
+                {
+                    Erase(it);
+                    return image_ptr();
+                }
+                m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+                return it->second.image;
+            }
+
+            void Put(const char *path, const ICompressor &codec, uint16_t blkSize, uint32_t chunkSize,
+                     const struct stat &st, const image_ptr &image)
+            {
+                if (!image || image->Size() > m_capacity)
+                    return;
+
+                std::string key = Key(path, codec, blkSize, chunkSize);
+                std::map<std::string, Entry>::iterator it = m_entries.find(key);
+                if (it != m_entries.end())
+                    Erase(it);
+
+                while (!m_lru.empty() && m_bytes + image->Size() > m_capacity)
+                    Erase(m_entries.find(m_lru.back()));
+
+                m_lru.push_front(key);
+                it = m_entries.insert(std::make_pair(key, Entry(image, Version(st)))).first;
+                it->second.lru = m_lru.begin();
+                m_bytes += image->Size();
+            }
+
+        private:
+            static std::string Key(const char *path, const ICompressor &codec, uint16_t blkSize, uint32_t chunkSize)
+            {
+                char cache[64] = {0};
+                snprintf(cache, sizeof(cache), "%s:%u:%u:", codec.Name(), blkSize, chunkSize);
+                return std::string(cache) + path;
+            }
+            void Erase(std::map<std::string, Entry>::iterator it)
+            {
+                m_bytes -= it->second.image->Size();
+                m_lru.erase(it->second.lru);
+                m_entries.erase(it);
+            }
+        };
+    }
+}
+#endif
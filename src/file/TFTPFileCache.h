@@ -0,0 +1,417 @@
+#ifndef _OMS_FILE_TFTP_FILE_CACHE_H
+#define _OMS_FILE_TFTP_FILE_CACHE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "file/TFTPFileProvider.h"
+#include "msg/TFTPMessages.h"
+
+namespace oms
+{
+    namespace file
+    {
+        // An opened and validated file below the root. Sessions share it and
+        // the fd is closed when the last of them and the cache let go, so a
+        // transfer keeps reading the file it started on even if it is
+        // replaced meanwhile.
+        class TFTPOpenFile
+        {
+            int m_fd;
+            struct stat m_stat;
+            std::string m_path;
+
+            TFTPOpenFile(const TFTPOpenFile &);
+            TFTPOpenFile &operator=(const TFTPOpenFile &);
+
+        public:
+            TFTPOpenFile(int fd, const struct stat &st, const std::string &path) : m_fd(fd), m_stat(st), m_path(path)
+            {
+            }
+            ~TFTPOpenFile()
+            {
+                if (m_fd >= 0)
+                    close(m_fd);
+            }
+
+            int Fd() const
+            {
+                return m_fd;
+            }
+            uint64_t Size() const
+            {
+                return m_stat.st_size;
+            }
+            const struct stat &Stat() const
+            {
+                return m_stat;
+            }
+            // relative to the root
+            const char *Path() const
+            {
+                return m_path.c_str();
+            }
+        };
+
+        // Bounded cache of RRQ path resolutions: normalized name -> shared
+        // open fd and stat. Cached files are watched with inotify and dropped
+        // as soon as they are written, change attributes (which includes
+        // losing a link to unlink or rename over them) or move; poll
+        // NotifyFd() and call ProcessEvents(). The watch does not see a
+        // directory above the file renamed or swapped, so a hit also stats
+        // the path and drops the entry when it names another inode now. A
+        // hit costs that one syscall instead of open, fstat, readlink and
+        // inotify_add_watch. Misses are not cached, a file that appears is
+        // found on the next request.
+        //
+        // A miss opens the file on the calling thread, which may stall on
+        // NFS or FUSE. The event loop should reach the cache through
+        // CachedFileBackend and ReadAheadFileProvider, whose workers take
+        // the misses. The cache is thread safe for that.
+        class TFTPFileCache
+        {
+        public:
+            typedef std::shared_ptr<const TFTPOpenFile> file_ptr;
+
+        private:
+            struct Entry
+            {
+                file_ptr file;
+                int wd;
+                std::list<std::string>::iterator lru;
+            };
+
+            std::string m_root;
+            size_t m_capacity;
+            int m_inotify;
+            std::map<std::string, Entry> m_entries;
+            std::list<std::string> m_lru;
+            std::map<int, std::set<std::string> > m_watches;
+            uint64_t m_hits;
+            uint64_t m_misses;
+            mutable std::mutex m_lock;
+
+            TFTPFileCache(const TFTPFileCache &);
+            TFTPFileCache &operator=(const TFTPFileCache &);
+
+        public:
+            TFTPFileCache(const char *root, size_t capacity = 256)
+                : m_capacity(capacity ? capacity : 1), m_hits(0), m_misses(0)
+            {
+                char resolved[PATH_MAX];
+                m_root = realpath(root, resolved) ? resolved : root;
+                // "/" stays, any other root loses its trailing slashes
+                while (m_root.length() > 1 && m_root[m_root.length() - 1] == '/')
+                    m_root.erase(m_root.length() - 1);
+                m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            }
+            ~TFTPFileCache()
+            {
+                if (m_inotify >= 0)
+                    close(m_inotify);
+            }
+
+            int NotifyFd() const
+            {
+                return m_inotify;
+            }
+            size_t Size() const
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                return m_entries.size();
+            }
+            uint64_t Hits() const
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                return m_hits;
+            }
+            uint64_t Misses() const
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                return m_misses;
+            }
+
+            // Resolves a requested file name below the root. On failure
+            // errcode is set to the TFTP error to answer with.
+            file_ptr Acquire(const char *name, uint16_t *errcode = NULL)
+            {
+                std::string rel;
+                if (!Normalize(name, rel))
+                    return Fail(errcode, msg::TFTP_ERR_ACCESS_VIOLATION);
+
+                std::string full = m_root + (m_root.length() > 1 ? "/" : "") + rel;
+                file_ptr cached;
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    std::map<std::string, Entry>::iterator it = m_entries.find(rel);
+                    if (it != m_entries.end())
+                        cached = it->second.file;
+                }
+                if (cached)
+                {
+                    struct stat now;
+                    bool same = !fstatat(AT_FDCWD, full.c_str(), &now, AT_SYMLINK_NOFOLLOW) &&
+                                now.st_dev == cached->Stat().st_dev && now.st_ino == cached->Stat().st_ino;
+
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    std::map<std::string, Entry>::iterator it = m_entries.find(rel);
+                    bool current = it != m_entries.end() && it->second.file == cached;
+                    if (same)
+                    {
+                        m_hits++;
+                        if (current)
+                            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+                        return cached;
+                    }
+                    if (current)
+                        Erase(rel);
+                }
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_misses++;
+                }
+
+                // O_NONBLOCK: a FIFO must not hang the open, S_ISREG
+                // rejects it right after
+                int fd = open(full.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+                if (fd < 0)
+                    return Fail(errcode, errno == ENOENT ? msg::TFTP_ERR_FILE_NOT_FOUND : msg::TFTP_ERR_ACCESS_VIOLATION);
+
+                // A symlinked directory on the way may still lead out. Check
+                // where the fd itself ended up, resolving the path again
+                // would race with a directory swapped in meanwhile.
+                struct stat st;
+                char proc[64];
+                snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+                if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !Beneath(proc))
+                {
+                    close(fd);
+                    return Fail(errcode, msg::TFTP_ERR_ACCESS_VIOLATION);
+                }
+
+                // Watch the inode that was opened, through the fd. A change
+                // between open and watch shows in ctime and leaves the file
+                // uncached; without a watch there is no invalidation either.
+                int wd = m_inotify < 0 ? -1 : inotify_add_watch(m_inotify, proc,
+                                                                 IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                                                     IN_MOVE_SELF | IN_DELETE_SELF);
+                struct stat now;
+                bool cache = wd >= 0 && !fstat(fd, &now) && now.st_ctim.tv_sec == st.st_ctim.tv_sec &&
+                             now.st_ctim.tv_nsec == st.st_ctim.tv_nsec;
+
+                file_ptr file = std::make_shared<const TFTPOpenFile>(fd, st, rel);
+                std::lock_guard<std::mutex> guard(m_lock);
+                if (!cache)
+                {
+                    // the watch may be shared with a cached alias
+                    if (wd >= 0 && !m_watches.count(wd))
+                        inotify_rm_watch(m_inotify, wd);
+                    return file;
+                }
+                // another thread missed on the same name meanwhile
+                std::map<std::string, Entry>::iterator it = m_entries.find(rel);
+                if (it != m_entries.end())
+                    return it->second.file;
+                Insert(rel, wd, file);
+                return file;
+            }
+
+            void Invalidate(const char *name)
+            {
+                std::string rel;
+                std::lock_guard<std::mutex> guard(m_lock);
+                if (Normalize(name, rel))
+                    Erase(rel);
+            }
+
+            // returns the number of entries dropped
+            size_t ProcessEvents()
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                size_t dropped = 0;
+                char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                for (;;)
+                {
+                    ssize_t len = read(m_inotify, buf, sizeof(buf));
+                    if (len <= 0)
+                        break;
+
+                    for (char *p = buf; p < buf + len;)
+                    {
+                        const struct inotify_event *ev = (const struct inotify_event *)p;
+                        p += sizeof(struct inotify_event) + ev->len;
+
+                        std::map<int, std::set<std::string> >::iterator it = m_watches.find(ev->wd);
+                        if (it == m_watches.end())
+                            continue;
+
+                        std::set<std::string> keys;
+                        keys.swap(it->second);
+                        m_watches.erase(it);
+                        if (!(ev->mask & IN_IGNORED))
+                            inotify_rm_watch(m_inotify, ev->wd);
+
+                        for (std::set<std::string>::iterator k = keys.begin(); k != keys.end(); k++)
+                        {
+                            std::map<std::string, Entry>::iterator e = m_entries.find(*k);
+                            if (e != m_entries.end())
+                            {
+                                e->second.wd = -1;
+                                Erase(*k);
+                                dropped++;
+                            }
+                        }
+                    }
+                }
+                return dropped;
+            }
+
+            // Lexically normalizes a request name relative to the root:
+            // leading slashes, "." and empty components go, ".." may not
+            // climb above the root.
+            static bool Normalize(const char *name, std::string &rel)
+            {
+                if (!name || !*name)
+                    return false;
+
+                std::vector<std::string> parts;
+                const char *p = name;
+                while (*p)
+                {
+                    const char *end = strchr(p, '/');
+                    size_t n = end ? (size_t)(end - p) : strlen(p);
+                    std::string part(p, n);
+                    p += n;
+                    if (*p)
+                        p++;
+
+                    if (part.empty() || part == ".")
+                        continue;
+                    if (part == "..")
+                    {
+                        if (parts.empty())
+                            return false;
+                        parts.pop_back();
+                        continue;
+                    }
+                    parts.push_back(part);
+                }
+                if (parts.empty())
+                    return false;
+
+                rel.clear();
+                for (size_t i = 0; i < parts.size(); i++)
+                {
+                    if (i)
+                        rel += '/';
+                    rel += parts[i];
+                }
+                return true;
+            }
+
+        private:
+            static file_ptr Fail(uint16_t *errcode, uint16_t code)
+            {
+                if (errcode)
+                    *errcode = code;
+                return file_ptr();
+            }
+
+            // whether the magic link at proc points below the root
+            bool Beneath(const char *proc) const
+            {
+                char target[PATH_MAX];
+                ssize_t len = readlink(proc, target, sizeof(target) - 1);
+                if (len <= 0)
+                    return false;
+                target[len] = 0;
+                if (m_root == "/")
+                    return target[0] == '/';
+                return !strncmp(target, m_root.c_str(), m_root.length()) && target[m_root.length()] == '/';
+            }
+
+            // m_lock held
+            void Insert(const std::string &rel, int wd, const file_ptr &file)
+            {
+                while (m_entries.size() >= m_capacity)
+                    Erase(m_lru.back());
+
+                m_lru.push_front(rel);
+                Entry &e = m_entries[rel];
+                e.file = file;
+                e.wd = wd;
+                e.lru = m_lru.begin();
+                m_watches[wd].insert(rel);
+            }
+
+            // m_lock held
+            void Erase(const std::string &rel)
+            {
+                std::map<std::string, Entry>::iterator it = m_entries.find(rel);
+                if (it == m_entries.end())
+                    return;
+
+                // hard links and aliases of one inode share a watch
+                int wd = it->second.wd;
+                std::map<int, std::set<std::string> >::iterator w = m_watches.find(wd);
+                if (w != m_watches.end())
+                {
+                    w->second.erase(rel);
+                    if (w->second.empty())
+                    {
+                        m_watches.erase(w);
+                        inotify_rm_watch(m_inotify, wd);
+                    }
+                }
+
+                m_lru.erase(it->second.lru);
+                m_entries.erase(it);
+            }
+        };
+
+        // IFileBackend that opens through a TFTPFileCache, so the misses and
+        // their path checks run on the ReadAheadFileProvider workers and
+        // repeated opens of an image share one validated fd.
+        class CachedFileBackend : public IFileBackend
+        {
+            TFTPFileCache &m_cache;
+
+        public:
+            CachedFileBackend(TFTPFileCache &cache) : m_cache(cache)
+            {
+            }
+
+            void *Open(const char *path, uint64_t &size)
+            {
+                TFTPFileCache::file_ptr file = m_cache.Acquire(path);
+                if (!file)
+                    return NULL;
+                size = file->Size();
+                return new TFTPFileCache::file_ptr(file);
+            }
+            int64_t ReadAt(void *file, uint64_t off, uint8_t *buf, uint32_t len)
+            {
+                return PosixFileBackend::ReadFd((*(TFTPFileCache::file_ptr *)file)->Fd(), off, buf, len);
+            }
+            void Close(void *file)
+            {
+                delete (TFTPFileCache::file_ptr *)file;
+            }
+        };
+    }
+}
+#endif
@@ -0,0 +1,539 @@
+#ifndef _OMS_FILE_TFTP_FILE_PROVIDER_H
+#define _OMS_FILE_TFTP_FILE_PROVIDER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace oms
+{
+    namespace file
+    {
+        typedef enum
+        {
+            TFTP_FILE_ERROR = -1,
+            TFTP_FILE_PENDING = -2, // retry once ReadyFd() is readable
+        } tftp_file_status_e;
+
+        // What the server calls to get DATA payloads. None of the calls may
+        // block on storage: a provider that has to go to disk returns
+        // TFTP_FILE_PENDING and signals ReadyFd() when it is worth retrying.
+        class IFileProvider
+        {
+        public:
+            virtual ~IFileProvider() {}
+
+            // returns a reader handle > 0, or TFTP_FILE_ERROR
+            virtual int32_t Open(const char *path) = 0;
+            virtual void Close(int32_t reader) = 0;
+            // 0 with size set, TFTP_FILE_PENDING or TFTP_FILE_ERROR
+            virtual int32_t Stat(int32_t reader, uint64_t &size) = 0;
+            // payload of block index (0 based) into buf, which holds blkSize
+            // bytes; returns its length, TFTP_FILE_PENDING or TFTP_FILE_ERROR
+            virtual int32_t Read(int32_t reader, uint64_t index, uint16_t blkSize, uint8_t *buf) = 0;
+
+            // -1 when the provider never returns TFTP_FILE_PENDING
+            virtual int ReadyFd() const
+            {
+                return -1;
+            }
+            virtual void ClearReady()
+            {
+            }
+        };
+
+        class MemoryFileProvider : public IFileProvider
+        {
+            std::map<std::string, std::shared_ptr<const std::string> > m_files;
+            std::map<int32_t, std::shared_ptr<const std::string> > m_readers;
+            int32_t m_nextReader;
+
+            MemoryFileProvider(const MemoryFileProvider &);
+            MemoryFileProvider &operator=(const MemoryFileProvider &);
+
+        public:
+            MemoryFileProvider() : m_nextReader(1)
+            {
+            }
+
+            void Insert(const char *path, const std::string &content)
+            {
+                m_files[path] = std::make_shared<const std::string>(content);
+            }
+            void Remove(const char *path)
+            {
+                m_files.erase(path);
+            }
+
+            int32_t Open(const char *path)
+            {
+                std::map<std::string, std::shared_ptr<const std::string> >::iterator it = m_files.find(path);
+                if (it == m_files.end())
+                    return TFTP_FILE_ERROR;
+                m_readers[m_nextReader] = it->second;
+                return m_nextReader++;
+            }
+            void Close(int32_t reader)
+            {
+                m_readers.erase(reader);
+            }
+            int32_t Stat(int32_t reader, uint64_t &size)
+            {
+                std::map<int32_t, std::shared_ptr<const std::string> >::iterator it = m_readers.find(reader);
+                if (it == m_readers.end())
+                    return TFTP_FILE_ERROR;
+                size = it->second->length();
+                return 0;
+            }
+            int32_t Read(int32_t reader, uint64_t index, uint16_t blkSize, uint8_t *buf)
+            {
+                std::map<int32_t, std::shared_ptr<const std::string> >::iterator it = m_readers.find(reader);
+                if (it == m_readers.end() || !buf)
+                    return TFTP_FILE_ERROR;
+
+                const std::string &data = *it->second;
+                uint64_t off = index * blkSize;
+                if (off > data.length())
+                    return TFTP_FILE_ERROR;
+
+                uint64_t n = data.length() - off < blkSize ? data.length() - off : blkSize;
+                memcpy(buf, data.data() + off, n);
+                return n;
+            }
+        };
+
+        // Blocking storage access, only ever called from the worker threads of
+        // ReadAheadFileProvider. Implementations must be thread safe.
+        class IFileBackend
+        {
+        public:
+            virtual ~IFileBackend() {}
+
+            // NULL on failure
+            virtual void *Open(const char *path, uint64_t &size) = 0;
+            virtual int64_t ReadAt(void *file, uint64_t off, uint8_t *buf, uint32_t len) = 0;
+            virtual void Close(void *file) = 0;
+        };
+
+        class PosixFileBackend : public IFileBackend
+        {
+        public:
+            void *Open(const char *path, uint64_t &size)
+            {
+                int fd = open(path, O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                    return NULL;
+
+                struct stat st;
+                if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+                {
+                    close(fd);
+                    return NULL;
+                }
+                size = st.st_size;
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                return new int(fd);
+            }
+            int64_t ReadAt(void *file, uint64_t off, uint8_t *buf, uint32_t len)
+            {
+                return ReadFd(*(int *)file, off, buf, len);
+            }
+            void Close(void *file)
+            {
+                close(*(int *)file);
+                delete (int *)file;
+            }
+
+            // pread until len bytes or end of file
+            static int64_t ReadFd(int fd, uint64_t off, uint8_t *buf, uint32_t len)
+            {
+                uint32_t done = 0;
+                while (done < len)
+                {
+                    ssize_t ret = pread(fd, buf + done, len - done, off + done);
+                    if (ret < 0 && errno == EINTR)
+                        continue;
+                    if (ret <= 0)
+                        return ret < 0 ? -1 : done;
+                    done += ret;
+                }
+                return done;
+            }
+        };
+
+        // Serves blocks from a chunk cache filled by a pool of worker threads.
+        // Readers of the same path share one open file and its cache. Every
+        // Read() schedules the chunks from the reader's position up to
+        // readAhead chunks ahead of it, and chunks that all readers of the
+        // file are past are dropped. Past maxChunks only the read-ahead
+        // windows of the readers are kept. The network thread only
+        // ever copies from memory; opens and reads run on the pool, which
+        // signals ReadyFd() whenever one completes.
+        class ReadAheadFileProvider : public IFileProvider
+        {
+            enum
+            {
+                STATE_LOADING,
+                STATE_READY,
+                STATE_FAILED,
+            };
+
+            struct Chunk
+            {
+                int state;
+                std::vector<uint8_t> data;
+
+                Chunk() : state(STATE_LOADING)
+                {
+                }
+            };
+
+            struct File
+            {
+                IFileBackend &backend;
+                std::string path;
+                void *handle;
+                uint64_t size;
+                int state;
+                std::map<uint64_t, Chunk> chunks;
+                std::map<int32_t, uint64_t> readers; // reader -> chunk index
+                std::multiset<uint64_t> positions;   // chunk index of every reader
+
+                File(IFileBackend &b, const char *p) : backend(b), path(p), handle(NULL), size(0),
+                                                       state(STATE_LOADING)
+                {
+                }
+                // the last reference is always dropped by a worker
+                ~File()
+                {
+                    if (handle)
+                        backend.Close(handle);
+                }
+            };
+            typedef std::shared_ptr<File> file_ptr;
+
+            enum
+            {
+                JOB_OPEN = -1,
+                JOB_CLOSE = -2,
+            };
+            struct Job
+            {
+                file_ptr file;
+                int64_t chunk; // chunk index or JOB_*
+            };
+
+            IFileBackend &m_backend;
+            uint32_t m_chunkSize;
+            uint32_t m_readAhead;
+            size_t m_maxChunks;
+
+            std::mutex m_lock;
+            std::condition_variable m_cond;
+            std::deque<Job> m_jobs;
+            bool m_stop;
+            std::vector<std::thread> m_workers;
+            int m_eventFd;
+
+            std::map<std::string, file_ptr> m_files;
+            std::map<int32_t, file_ptr> m_readers;
+            int32_t m_nextReader;
+
+            ReadAheadFileProvider(const ReadAheadFileProvider &);
+            ReadAheadFileProvider &operator=(const ReadAheadFileProvider &);
+
+        public:
+            // maxChunks bounds the read-ahead of one file, chunks a reader is
+            // waiting on are always loaded
+            ReadAheadFileProvider(IFileBackend &backend, uint32_t threads = 4, uint32_t chunkSize = 256 * 1024,
+                                  uint32_t readAhead = 4, size_t maxChunks = 64)
+                : m_backend(backend), m_chunkSize(chunkSize ? chunkSize : 1), m_readAhead(readAhead),
+                  m_maxChunks(maxChunks), m_stop(false), m_nextReader(1)
+            {
+                m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                for (uint32_t i = 0; i < (threads ? threads : 1); i++)
+                    m_workers.push_back(std::thread(&ReadAheadFileProvider::Worker, this));
+            }
+            ~ReadAheadFileProvider()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_stop = true;
+                }
+                m_cond.notify_all();
+                for (size_t i = 0; i < m_workers.size(); i++)
+                    m_workers[i].join();
+                if (m_eventFd >= 0)
+                    close(m_eventFd);
+            }
+
+            int ReadyFd() const
+            {
+                return m_eventFd;
+            }
+            void ClearReady()
+            {
+                uint64_t v;
+                while (read(m_eventFd, &v, sizeof(v)) == sizeof(v))
+                    ;
+            }
+
+            int32_t Open(const char *path)
+            {
+                if (!path)
+                    return TFTP_FILE_ERROR;
+
+                std::lock_guard<std::mutex> guard(m_lock);
+                file_ptr &f = m_files[path];
+                if (!f || f->state == STATE_FAILED)
+                {
+                    f = std::make_shared<File>(m_backend, path);
+                    Post(f, JOB_OPEN);
+                }
+
+                int32_t reader = m_nextReader++;
+                f->readers[reader] = 0;
+                f->positions.insert(0);
+                m_readers[reader] = f;
+                return reader;
+            }
+
+            void Close(int32_t reader)
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                std::map<int32_t, file_ptr>::iterator it = m_readers.find(reader);
+                if (it == m_readers.end())
+                    return;
+
+                file_ptr f = it->second;
+                m_readers.erase(it);
+                std::map<int32_t, uint64_t>::iterator rit = f->readers.find(reader);
+                f->positions.erase(f->positions.find(rit->second));
+                f->readers.erase(rit);
+                if (f->readers.empty())
+                {
+                    std::map<std::string, file_ptr>::iterator fit = m_files.find(f->path);
+                    if (fit != m_files.end() && fit->second == f)
+                        m_files.erase(fit);
+                    // hand the last reference to a worker, closing may block
+                    Post(f, JOB_CLOSE);
+                }
+                else
+                {
+                    Evict(*f);
+                }
+            }
+
+            int32_t Stat(int32_t reader, uint64_t &size)
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                std::map<int32_t, file_ptr>::iterator it = m_readers.find(reader);
+                if (it == m_readers.end() || it->second->state == STATE_FAILED)
+                    return TFTP_FILE_ERROR;
+                if (it->second->state == STATE_LOADING)
+                    return TFTP_FILE_PENDING;
+                size = it->second->size;
+                return 0;
+            }
+
+            int32_t Read(int32_t reader, uint64_t index, uint16_t blkSize, uint8_t *buf)
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                std::map<int32_t, file_ptr>::iterator it = m_readers.find(reader);
+                if (it == m_readers.end() || !buf || !blkSize)
+                    return TFTP_FILE_ERROR;
+
+                file_ptr f = it->second;
+                if (f->state != STATE_READY)
+                    return f->state == STATE_LOADING ? TFTP_FILE_PENDING : TFTP_FILE_ERROR;
+
+                uint64_t off = index * blkSize;
+                if (off > f->size)
+                    return TFTP_FILE_ERROR;
+                uint32_t len = f->size - off < blkSize ? f->size - off : blkSize;
+
+                Prefetch(f, off, len);
+
+                // most reads stay in the chunk of the previous one, only a
+                // reader moving to another chunk can free anything
+                uint64_t &pos = f->readers[reader];
+                if (pos != off / m_chunkSize)
+                {
+                    f->positions.erase(f->positions.find(pos));
+                    pos = off / m_chunkSize;
+                    f->positions.insert(pos);
+                    Evict(*f);
+                }
+
+                int32_t ret = len;
+                for (uint32_t done = 0; done < len;)
+                {
+                    uint64_t pos = off + done;
+                    std::map<uint64_t, Chunk>::iterator cit = f->chunks.find(pos / m_chunkSize);
+                    if (cit == f->chunks.end() || cit->second.state == STATE_LOADING)
+                        return TFTP_FILE_PENDING;
+                    if (cit->second.state == STATE_FAILED)
+                        return TFTP_FILE_ERROR;
+
+                    uint32_t in = pos % m_chunkSize;
+                    uint32_t n = cit->second.data.size() - in;
+                    if (n > len - done)
+                        n = len - done;
+                    memcpy(buf + done, &cit->second.data[in], n);
+                    done += n;
+                }
+                return ret;
+            }
+
+            // chunks currently cached or loading for path, for tests and stats
+            size_t Cached(const char *path)
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                std::map<std::string, file_ptr>::iterator it = m_files.find(path);
+                return it == m_files.end() ? 0 : it->second->chunks.size();
+            }
+
+        private:
+            // m_lock held
+            void Post(const file_ptr &f, int64_t chunk)
+            {
+                Job job;
+                job.file = f;
+                job.chunk = chunk;
+                m_jobs.push_back(job);
+                m_cond.notify_one();
+            }
+
+            // m_lock held
+            void Prefetch(const file_ptr &f, uint64_t off, uint32_t len)
+            {
+                if (!f->size)
+                    return;
+
+                uint64_t last = (f->size - 1) / m_chunkSize;
+                uint64_t first = off / m_chunkSize;
+                uint64_t need = len ? (off + len - 1) / m_chunkSize : first;
+                uint64_t end = need + m_readAhead;
+                if (end > last)
+                    end = last;
+
+                for (uint64_t i = first; i <= end && i <= last; i++)
+                {
+                    if (f->chunks.count(i))
+                        continue;
+                    if (i > need && f->chunks.size() >= m_maxChunks)
+                        break;
+                    f->chunks[i];
+                    Post(f, i);
+                }
+            }
+
+            // m_lock held, drops chunks every reader is past; called when a
+            // reader moved, O(log readers) unless over maxChunks
+            void Evict(File &f)
+            {
+                if (f.positions.empty())
+                    return;
+
+                // a chunk still loading is dropped by its worker when done
+                f.chunks.erase(f.chunks.begin(), f.chunks.lower_bound(*f.positions.begin()));
+
+                // readers far apart: give up what lies between them rather
+                // than cache the whole gap, the slow reader loads it again
+                std::map<uint64_t, Chunk>::iterator it = f.chunks.begin();
+                while (f.chunks.size() > m_maxChunks && it != f.chunks.end())
+                {
+                    if (it->second.state == STATE_LOADING || InWindow(f, it->first))
+                        it++;
+                    else
+                        f.chunks.erase(it++);
+                }
+            }
+
+            // some reader is at most m_readAhead + 1 chunks before chunk
+            bool InWindow(const File &f, uint64_t chunk) const
+            {
+                uint64_t from = chunk > m_readAhead + 1 ? chunk - m_readAhead - 1 : 0;
+                std::multiset<uint64_t>::const_iterator it = f.positions.lower_bound(from);
+                return it != f.positions.end() && *it <= chunk;
+            }
+
+            void Signal()
+            {
+                uint64_t v = 1;
+                if (write(m_eventFd, &v, sizeof(v)) < 0)
+                {
+                    // counter saturated, the loop is already woken up
+                }
+            }
+
+            void Worker()
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                for (;;)
+                {
+                    while (!m_stop && m_jobs.empty())
+                        m_cond.wait(lock);
+                    if (m_stop)
+                        return;
+
+                    Job job = m_jobs.front();
+                    m_jobs.pop_front();
+                    File &f = *job.file;
+
+                    if (job.chunk == JOB_OPEN)
+                    {
+                        lock.unlock();
+                        uint64_t size = 0;
+                        void *handle = f.backend.Open(f.path.c_str(), size);
+                        lock.lock();
+
+                        f.handle = handle;
+                        f.size = size;
+                        f.state = handle ? STATE_READY : STATE_FAILED;
+                        Signal();
+                    }
+                    else if (job.chunk >= 0 && f.chunks.count(job.chunk))
+                    {
+                        uint64_t off = job.chunk * m_chunkSize;
+                        uint32_t len = f.size - off < m_chunkSize ? f.size - off : m_chunkSize;
+                        std::vector<uint8_t> data(len);
+
+                        lock.unlock();
+                        int64_t ret = f.backend.ReadAt(f.handle, off, data.empty() ? NULL : &data[0], len);
+                        lock.lock();
+
+                        std::map<uint64_t, Chunk>::iterator it = f.chunks.find(job.chunk);
+                        if (it != f.chunks.end())
+                        {
+                            it->second.state = ret == len ? STATE_READY : STATE_FAILED;
+                            it->second.data.swap(data);
+                        }
+                        Signal();
+                    }
+
+                    // may drop the last reference, outside the lock
+                    lock.unlock();
+                    job.file.reset();
+                    lock.lock();
+                }
+            }
+        };
+    }
+}
+#endif
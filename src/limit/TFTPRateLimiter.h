@@ -0,0 +1,145 @@
+#ifndef _OMS_LIMIT_TFTP_RATE_LIMITER_H
+#define _OMS_LIMIT_TFTP_RATE_LIMITER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include "session/TFTPSessionTable.h"
+
+namespace oms
+{
+    namespace limit
+    {
+        // Token bucket counting in thousandths of a token, so a rate in
+        // tokens per second refills rate units per millisecond.
+        class TFTPTokenBucket
+        {
+            uint64_t m_tokens;
+            uint64_t m_last;
+
+        public:
+            enum
+            {
+                SCALE = 1000,
+            };
+
+            TFTPTokenBucket() : m_tokens(0), m_last(0)
+            {
+            }
+
+            void Reset(uint32_t burst, uint64_t nowMs)
+            {
+                m_tokens = (uint64_t)burst * SCALE;
+                m_last = nowMs;
+            }
+            void Refill(uint32_t rate, uint32_t burst, uint64_t nowMs)
+            {
+                if (nowMs > m_last)
+                {
+                    m_tokens += (nowMs - m_last) * rate;
+                    m_last = nowMs;
+                }
+                if (m_tokens > (uint64_t)burst * SCALE)
+                    m_tokens = (uint64_t)burst * SCALE;
+            }
+            bool Take(uint64_t cost = SCALE)
+            {
+                if (m_tokens < cost)
+                    return false;
+                m_tokens -= cost;
+                return true;
+            }
+            // time until cost is available at rate, 0 when it is now; the
+            // unit is whatever the caller passes to Refill()
+            uint64_t Wait(uint32_t rate, uint64_t cost = SCALE) const
+            {
+                if (m_tokens >= cost)
+                    return 0;
+                if (!rate)
+                    return UINT64_MAX;
+                return (cost - m_tokens + rate - 1) / rate;
+            }
+            // full by nowMs, i.e. no different from a fresh bucket
+            bool Full(uint32_t rate, uint32_t burst, uint64_t nowMs) const
+            {
+                uint64_t tokens = m_tokens + (nowMs > m_last ? (nowMs - m_last) * rate : 0);
+                return tokens >= (uint64_t)burst * SCALE;
+            }
+        };
+
+        // Per-source limit on new requests. Sources are keyed by address only,
+        // a flood from rotating ports still hits one bucket. Once maxSources
+        // addresses are tracked, new ones share a single overflow bucket so a
+        // spoofed flood cannot grow the table. Only TFTP_CLASS_REQUEST packets
+        // are meant to go through here; packets of established sessions skip
+        // the limiter and keep their full rate.
+        class TFTPRateLimiter
+        {
+            session::TFTPSessionTable<TFTPTokenBucket> m_sources;
+            TFTPTokenBucket m_overflow;
+            uint32_t m_rate;
+            uint32_t m_burst;
+            size_t m_maxSources;
+            uint64_t m_dropped;
+
+            TFTPRateLimiter(const TFTPRateLimiter &);
+            TFTPRateLimiter &operator=(const TFTPRateLimiter &);
+
+        public:
+            // rate: requests per second per source, burst: bucket depth
+            TFTPRateLimiter(uint32_t rate, uint32_t burst, size_t maxSources)
+                : m_sources(maxSources < 1024 ? maxSources : 1024), m_rate(rate),
+                  m_burst(burst), m_maxSources(maxSources), m_dropped(0)
+            {
+                m_overflow.Reset(burst, 0);
+            }
+
+            size_t Sources() const
+            {
+                return m_sources.Size();
+            }
+            uint64_t Dropped() const
+            {
+                return m_dropped;
+            }
+
+            bool Allow(const session::TFTPEndpoint &src, uint64_t nowMs)
+            {
+                session::TFTPEndpoint key = src;
+                key.port = 0;
+
+                TFTPTokenBucket *bucket = m_sources.Find(key);
+                if (!bucket && m_sources.Size() < m_maxSources)
+                {
+                    bucket = m_sources.Insert(key);
+                    bucket->Reset(m_burst, nowMs);
+                }
+                if (!bucket)
+                    bucket = &m_overflow;
+
+                bucket->Refill(m_rate, m_burst, nowMs);
+                if (bucket->Take())
+                    return true;
+                m_dropped++;
+                return false;
+            }
+
+            // Forgets sources whose bucket has filled up again, they would get
+            // a fresh one anyway; call it from a periodic timer.
+            size_t Expire(uint64_t nowMs)
+            {
+                std::vector<session::TFTPEndpoint> idle;
+                m_sources.ForEach([&](const session::TFTPEndpoint &key, TFTPTokenBucket &bucket) {
+                    if (bucket.Full(m_rate, m_burst, nowMs))
+                        idle.push_back(key);
+                });
+                for (size_t i = 0; i < idle.size(); i++)
+                    m_sources.Erase(idle[i]);
+                return idle.size();
+            }
+        };
+    }
+}
+#endif
@@ -0,0 +1,108 @@
+#ifndef _OMS_MSG_TFTP_CLASSIFIER_H
+#define _OMS_MSG_TFTP_CLASSIFIER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "msg/TFTPMessages.h"
+
+namespace oms
+{
+    namespace msg
+    {
+        typedef enum
+        {
+            TFTP_CLASS_REQUEST,         // well formed RRQ/WRQ, rate limit then decode
+            TFTP_CLASS_SESSION,         // well formed packet of an established session
+            TFTP_CLASS_DROP_SHORT,      // shorter than any TFTP packet
+            TFTP_CLASS_DROP_OPCODE,     // opcode out of range
+            TFTP_CLASS_DROP_MALFORMED,  // bad length or missing terminator
+            TFTP_CLASS_DROP_UNKNOWN_TID // not a request and no session for the sender
+        } tftp_class_e;
+
+        // Checks a datagram before anything is decoded: opcode range, minimum
+        // and maximum length, string terminators and whether the sender is a
+        // known transfer ID. It only looks at the bytes in place and never
+        // allocates, so hostile traffic is dropped for the price of a scan.
+        // A packet it accepts still has to be decoded, which may still fail.
+        class TFTPClassifier
+        {
+        public:
+            enum
+            {
+                MIN_LENGTH = 4,
+                MAX_BLKSIZE = 65464,
+            };
+
+            // knownTid: the sender matches an established session
+            static tftp_class_e Classify(const uint8_t *buf, uint32_t len, bool knownTid)
+            {
+                if (!buf || len < MIN_LENGTH)
+                    return TFTP_CLASS_DROP_SHORT;
+
+                uint16_t opcode = (((uint16_t)buf[0]) << 8) | buf[1];
+                if (opcode < TFTP_OPCODE_RRQ || opcode > TFTP_OPCODE_OACK)
+                    return TFTP_CLASS_DROP_OPCODE;
+
+                if (opcode == TFTP_OPCODE_RRQ || opcode == TFTP_OPCODE_WRQ)
+                    return CheckRequest(buf + 2, len - 2) ? TFTP_CLASS_REQUEST : TFTP_CLASS_DROP_MALFORMED;
+
+                if (!knownTid)
+                    return TFTP_CLASS_DROP_UNKNOWN_TID;
+
+                bool ok = false;
+                int32_t n = 0;
+                switch (opcode)
+                {
+                case TFTP_OPCODE_DATA:
+                    ok = len <= 4 + MAX_BLKSIZE;
+                    break;
+                case FTFP_OPCODE_ACK:
+                    ok = len == 4;
+                    break;
+                case TFTP_OPCODE_ERR:
+                    ok = len >= 5 && !buf[len - 1];
+                    break;
+                case TFTP_OPCODE_OACK:
+                    n = Strings(buf + 2, len - 2);
+                    ok = n > 0 && !(n & 1);
+                    break;
+                }
+                return ok ? TFTP_CLASS_SESSION : TFTP_CLASS_DROP_MALFORMED;
+            }
+
+        private:
+            // number of NUL terminated strings filling buf exactly, -1 when the
+            // last one is unterminated
+            static int32_t Strings(const uint8_t *buf, uint32_t len)
+            {
+                if (!len || buf[len - 1])
+                    return -1;
+
+                int32_t n = 0;
+                const uint8_t *p = buf, *end = buf + len;
+                while (p < end)
+                {
+                    p = (const uint8_t *)memchr(p, 0, end - p) + 1;
+                    n++;
+                }
+                return n;
+            }
+
+            // filename, mode, then option name/value pairs
+            static bool CheckRequest(const uint8_t *buf, uint32_t len)
+            {
+                int32_t n = Strings(buf, len);
+                if (n < 2 || (n & 1) || !buf[0])
+                    return false;
+
+                // terminated, Strings() checked
+                const char *m = (const char *)memchr(buf, 0, len) + 1;
+                return !strcasecmp(m, "octet") || !strcasecmp(m, "netascii") || !strcasecmp(m, "mail");
+            }
+        };
+    }
+}
+#endif
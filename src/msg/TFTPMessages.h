@@ -172,11 +172,11 @@ namespace oms
             }
             static tftp_transfer_mode_e StrToTransferMode(const char *str)
             {
-                if (strcasecmp("mail", str))
+                if (!strcasecmp("mail", str))
                     return TFTP_MODE_MAIL;
-                if (strcasecmp("octet", str))
+                if (!strcasecmp("octet", str))
                     return TFTP_MODE_OCTET;
-                if (strcasecmp("netascii", str))
+                if (!strcasecmp("netascii", str))
                     return TFTP_MODE_NETASCII;
                 return TFTP_MODE_INVALID;
             }
@@ -243,10 +243,14 @@ namespace oms
                     return ret;
                 off += ret;
 
-                ret = m_opts.Encode(buf + off, len - off);
-                if (ret <= 0)
-                    return ret;
-                off += ret;
+                // options are optional in a request
+                if (!m_opts.empty())
+                {
+                    ret = m_opts.Encode(buf + off, len - off);
+                    if (ret <= 0)
+                        return ret;
+                    off += ret;
+                }
 
                 return off;
             }
@@ -274,10 +278,13 @@ namespace oms
 
                 m_transfermode = StrToTransferMode(mode.c_str());
 
-                ret = m_opts.Decode(buf + off, len - off);
-                if (ret <= 0)
-                    return ret;
-                off += ret;
+                if (off < len)
+                {
+                    ret = m_opts.Decode(buf + off, len - off);
+                    if (ret <= 0)
+                        return ret;
+                    off += ret;
+                }
 
                 return off;
             }
@@ -321,6 +328,9 @@ namespace oms
             uint8_t *m_blockData;
             uint16_t m_blockDataLength;
 
+            TFTPDataMessage(const TFTPDataMessage &);
+            TFTPDataMessage &operator=(const TFTPDataMessage &);
+
         public:
             TFTPDataMessage() : TFTPMessage(TFTP_OPCODE_DATA),
                                 m_blockNumber(0), m_blockData(NULL), m_blockDataLength(0)
@@ -338,6 +348,10 @@ namespace oms
                     memcpy(m_blockData, blkData, blkDataLen);
                 }
             }
+            ~TFTPDataMessage()
+            {
+                free(m_blockData);
+            }
 
             void SetBlockNumber(uint16_t blkNum)
             {
@@ -345,7 +359,7 @@ namespace oms
             }
             void SetBlockData(const uint8_t *blkData, uint16_t blkDataLen)
             {
-                if (!blkData || blkDataLen)
+                if (!blkData || !blkDataLen)
                 {
                     free(m_blockData);
                     m_blockData = NULL;
@@ -474,7 +488,7 @@ namespace oms
         public:
             TFTPErrMessage(uint16_t errorCode = 0, const char *errorMsg = NULL) : TFTPMessage(TFTP_OPCODE_ERR),
                                                                                   m_errorCode(errorCode),
-                                                                                  m_errorMsg(errorMsg)
+                                                                                  m_errorMsg(errorMsg ? errorMsg : "")
             {
             }
 
@@ -489,7 +503,7 @@ namespace oms
 
             void SetErrorMsg(const char *errorMsg)
             {
-                m_errorMsg = errorMsg;
+                m_errorMsg = errorMsg ? errorMsg : "";
             }
 
             uint16_t ErrorCode() const
@@ -14,6 +14,9 @@ namespace oms
 #define TFTP_OPT_TSIZE "tsize"
 #define TFTP_OPT_BLKSIZE "blksize"
 #define TFTP_OPT_TIMEOUT "timeout"
+#define TFTP_OPT_COMPRESS "compress"
+#define TFTP_OPT_RESUME "resume"
+#define TFTP_OPT_RESUME_SUM "rsum"
 
         class TFTPOpt
         {
@@ -52,7 +55,7 @@ namespace oms
             void SetValue(uint64_t v)
             {
                 char cache[64] = {0};
-                snprintf(cache, 16, "%llu", v);
+                snprintf(cache, sizeof(cache), "%llu", (unsigned long long)v);
                 m_value = cache;
             }
             const char *Name() const
@@ -0,0 +1,195 @@
+#ifndef _OMS_NET_TFTP_PATH_MTU_H
+#define _OMS_NET_TFTP_PATH_MTU_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <vector>
+#include "msg/TFTPOption.h"
+#include "session/TFTPSessionTable.h"
+
+namespace oms
+{
+    namespace net
+    {
+        // Path MTU of a connected UDP socket, and the largest blksize whose
+        // DATA fits it without IP fragmentation.
+        class TFTPPathMtu
+        {
+        public:
+            enum
+            {
+                IPV4_HEADER = 20,
+                IPV6_HEADER = 40,
+                UDP_HEADER = 8,
+                TFTP_DATA_HEADER = 4,
+                MIN_BLKSIZE = 8, // RFC 2348
+                MAX_BLKSIZE = 65464,
+                DEFAULT_BLKSIZE = 512,
+            };
+
+            // Sets DF on everything sent from fd, an oversized datagram then
+            // fails with EMSGSIZE instead of going out fragmented, and the
+            // kernel tracks the path MTU from ICMP for Query().
+            static int32_t EnableDiscovery(int fd, int family)
+            {
+                int v = family == AF_INET6 ? IPV6_PMTUDISC_DO : IP_PMTUDISC_DO;
+                if (family == AF_INET6)
+                    return setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &v, sizeof(v));
+                return setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &v, sizeof(v));
+            }
+
+            // fd must be connected to the peer; -1 on failure
+            static int32_t Query(int fd, int family)
+            {
+                int mtu = 0;
+                socklen_t len = sizeof(mtu);
+                int ret = family == AF_INET6 ? getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &len)
+                                             : getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &len);
+                return ret < 0 ? -1 : mtu;
+            }
+
+            static uint32_t MaxBlkSize(uint32_t mtu, int family)
+            {
+                uint32_t overhead = (family == AF_INET6 ? IPV6_HEADER : IPV4_HEADER) + UDP_HEADER + TFTP_DATA_HEADER;
+                if (mtu < overhead + MIN_BLKSIZE)
+                    return MIN_BLKSIZE;
+                return mtu - overhead > MAX_BLKSIZE ? (uint32_t)MAX_BLKSIZE : mtu - overhead;
+            }
+
+            // Answers the client's blksize with at most what fits the path.
+            // RFC 2348 only lets the server lower the value, and an option the
+            // client did not send must not appear in the OACK, so a client that
+            // does not ask stays at 512. Returns the blksize to use, -1 when
+            // the requested value is malformed.
+            static int32_t Negotiate(const msg::TFTPOpts &req, msg::TFTPOpts &oack, uint32_t mtu, int family)
+            {
+                msg::TFTPOpts::const_iterator it = req.find(TFTP_OPT_BLKSIZE);
+                if (it == req.end())
+                    return DEFAULT_BLKSIZE;
+
+                char *end = NULL;
+                const char *v = it->Value();
+                unsigned long asked = strtoul(v, &end, 10);
+                if (*v < '0' || *v > '9' || *end || asked < MIN_BLKSIZE)
+                    return -1;
+
+                uint32_t blksize = MaxBlkSize(mtu, family);
+                if (asked < blksize)
+                    blksize = asked;
+                oack.insert(TFTP_OPT_BLKSIZE, blksize);
+                return blksize;
+            }
+
+            // Next common MTU below mtu (RFC 1191 plateaus plus Ethernet and
+            // IPv6 minimum); the floor is 576.
+            static uint32_t LowerPlateau(uint32_t mtu)
+            {
+                static const uint32_t plateaus[] = {65535, 32000, 17914, 9000, 8166, 4352, 2002,
+                                                    1500, 1492, 1280, 1006, 576};
+                for (size_t i = 0; i < sizeof(plateaus) / sizeof(plateaus[0]); i++)
+                {
+                    if (plateaus[i] < mtu)
+                        return plateaus[i];
+                }
+                return 576;
+            }
+        };
+
+        // What has been learned about the path to each peer address: MTUs
+        // reported by the kernel after EMSGSIZE, and black holes found when a
+        // client never acks the first full sized DATA. The blksize of a
+        // running transfer cannot change, so a black hole only helps the
+        // client's retry. Entries expire after ttlMs and the next transfer
+        // probes the interface MTU again.
+        class TFTPPathMtuCache
+        {
+            struct Entry
+            {
+                uint32_t mtu;
+                uint64_t expires;
+
+                Entry() : mtu(0), expires(0)
+                {
+                }
+            };
+
+            session::TFTPSessionTable<Entry> m_peers;
+            uint64_t m_ttl;
+            size_t m_maxPeers;
+
+            TFTPPathMtuCache(const TFTPPathMtuCache &);
+            TFTPPathMtuCache &operator=(const TFTPPathMtuCache &);
+
+        public:
+            TFTPPathMtuCache(uint64_t ttlMs = 10 * 60 * 1000, size_t maxPeers = 65536)
+                : m_ttl(ttlMs), m_maxPeers(maxPeers)
+            {
+            }
+
+            size_t Size() const
+            {
+                return m_peers.Size();
+            }
+
+            // MTU to use towards peer given the egress interface or socket MTU
+            uint32_t Lookup(const session::TFTPEndpoint &peer, uint32_t mtu, uint64_t nowMs)
+            {
+                Entry *e = m_peers.Find(Key(peer));
+                if (!e)
+                    return mtu;
+                if (e->expires <= nowMs)
+                {
+                    m_peers.Erase(Key(peer));
+                    return mtu;
+                }
+                return e->mtu < mtu ? e->mtu : mtu;
+            }
+
+            void Update(const session::TFTPEndpoint &peer, uint32_t mtu, uint64_t nowMs)
+            {
+                Entry *e = m_peers.Find(Key(peer));
+                if (!e && m_peers.Size() >= m_maxPeers)
+                    return;
+                if (!e)
+                    e = m_peers.Insert(Key(peer));
+                e->mtu = mtu;
+                e->expires = nowMs + m_ttl;
+            }
+
+            // The peer stopped acking DATA sent with failedMtu, returns the
+            // MTU its next transfer gets.
+            uint32_t ReportBlackHole(const session::TFTPEndpoint &peer, uint32_t failedMtu, uint64_t nowMs)
+            {
+                uint32_t mtu = TFTPPathMtu::LowerPlateau(failedMtu);
+                Update(peer, mtu, nowMs);
+                return mtu;
+            }
+
+            size_t Expire(uint64_t nowMs)
+            {
+                std::vector<session::TFTPEndpoint> stale;
+                m_peers.ForEach([&](const session::TFTPEndpoint &key, Entry &e) {
+                    if (e.expires <= nowMs)
+                        stale.push_back(key);
+                });
+                for (size_t i = 0; i < stale.size(); i++)
+                    m_peers.Erase(stale[i]);
+                return stale.size();
+            }
+
+        private:
+            static session::TFTPEndpoint Key(const session::TFTPEndpoint &peer)
+            {
+                session::TFTPEndpoint key = peer;
+                key.port = 0;
+                return key;
+            }
+        };
+    }
+}
+#endif
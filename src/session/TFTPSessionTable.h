@@ -0,0 +1,495 @@
+#ifndef _OMS_SESSION_TFTP_SESSION_TABLE_H
+#define _OMS_SESSION_TFTP_SESSION_TABLE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <new>
+#include <vector>
+
+namespace oms
+{
+    namespace session
+    {
+        // Transfer ID of a peer, IPv4 addresses are kept as IPv4 mapped IPv6
+        // so both families share one 20 byte key.
+        struct TFTPEndpoint
+        {
+            uint8_t addr[16];
+            uint16_t port; // network order
+            uint16_t family;
+
+            TFTPEndpoint()
+            {
+                memset(this, 0, sizeof(*this));
+            }
+
+            static TFTPEndpoint FromIPv4(uint32_t addr, uint16_t port)
+            {
+                TFTPEndpoint ep;
+                ep.addr[10] = 0xFF;
+                ep.addr[11] = 0xFF;
+                memcpy(&ep.addr[12], &addr, sizeof(addr));
+                ep.port = port;
+                ep.family = AF_INET;
+                return ep;
+            }
+            static TFTPEndpoint FromIPv6(const uint8_t *addr, uint16_t port)
+            {
+                TFTPEndpoint ep;
+                memcpy(ep.addr, addr, sizeof(ep.addr));
+                ep.port = port;
+                ep.family = AF_INET6;
+                return ep;
+            }
+            static TFTPEndpoint FromSockAddr(const struct sockaddr *sa)
+            {
+                if (sa && sa->sa_family == AF_INET)
+                {
+                    const struct sockaddr_in *in = (const struct sockaddr_in *)sa;
+                    return FromIPv4(in->sin_addr.s_addr, in->sin_port);
+                }
+                if (sa && sa->sa_family == AF_INET6)
+                {
+                    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)sa;
+                    return FromIPv6(in6->sin6_addr.s6_addr, in6->sin6_port);
+                }
+                return TFTPEndpoint();
+            }
+
+            bool operator==(const TFTPEndpoint &o) const
+            {
+                return !memcmp(this, &o, sizeof(*this));
+            }
+
+            uint32_t Hash() const
+            {
+                uint64_t a, b;
+                memcpy(&a, &addr[0], sizeof(a));
+                memcpy(&b, &addr[8], sizeof(b));
+
+                uint64_t h = (a * 0x9E3779B97F4A7C15ull) ^ (b * 0xC2B2AE3D27D4EB4Full) ^
+                             (((uint64_t)port << 16 | family) * 0x165667B19E3779F9ull);
+                h ^= h >> 29;
+                h *= 0xBF58476D1CE4E5B9ull;
+                h ^= h >> 32;
+                return (uint32_t)h;
+            }
+        };
+
+        // Per-session fields touched on every datagram, kept inline in the
+        // table so a lookup costs one probe sequence and no pointer chase.
+        struct TFTPSessionHot
+        {
+            uint64_t nextBlock;  // next block index to send or expect
+            uint64_t ackedBlock; // highest acked block index
+            uint16_t windowSize;
+            uint16_t inFlight;
+            uint32_t timerSlot; // handle into the timer wheel
+            uint32_t session;   // index of the cold per-session state
+
+            TFTPSessionHot() : nextBlock(0), ackedBlock(0), windowSize(1), inFlight(0),
+                               timerSlot(0), session(0)
+            {
+            }
+        };
+
+        // Robin Hood open addressing table keyed by TFTPEndpoint. Hashes, keys
+        // and values live in separate arrays so probing only walks the dense
+        // hash array.
+        //
+        // Growing never touches the whole table in one call. Once the load
+        // passes 3/4 the next, twice as large table is allocated
+        // uninitialized and its hash array is cleared a few slots per
+        // insert/erase. At 7/8 it takes over, and the old slots migrate a few
+        // per insert/erase; lookups check both tables until that is over.
+        //
+        // Pointers returned by Find/Insert are valid until the next Insert or
+        // Erase.
+        template <typename Value = TFTPSessionHot>
+        class TFTPSessionTable
+        {
+            enum
+            {
+                HASH_EMPTY = 0,
+                HASH_MOVED = 1,
+                MIGRATE_STEP = 16,
+                TRIM_STEP = 1024, // migrated slots returned to the kernel at once
+                CLEAR_STEP = 32, // 2 * capacity slots over capacity / 8 inserts, with slack
+                MIN_CAPACITY = 16,
+            };
+
+            // Raw arrays: keys and values are only constructed in slots whose
+            // hash is set, so allocating a table costs no initialization.
+            struct Table
+            {
+                uint32_t *hashes;
+                TFTPEndpoint *keys;
+                Value *values;
+                uint32_t mask;
+                size_t size;
+                size_t capacity;
+                size_t cleared; // hash slots set to HASH_EMPTY so far
+                size_t trimmed; // leading slots whose pages went back to the kernel
+
+                Table() : hashes(NULL), keys(NULL), values(NULL), mask(0), size(0), capacity(0), cleared(0), trimmed(0)
+                {
+                }
+                ~Table()
+                {
+                    Release();
+                }
+                void Allocate(size_t n)
+                {
+                    Release();
+                    hashes = (uint32_t *)Alloc(n * sizeof(uint32_t));
+                    keys = (TFTPEndpoint *)Alloc(n * sizeof(TFTPEndpoint));
+                    values = (Value *)Alloc(n * sizeof(Value));
+                    if (!hashes || !keys || !values)
+                    {
+                        Release();
+                        throw std::bad_alloc();
+                    }
+                    mask = n - 1;
+                    capacity = n;
+                }
+                // returns true once the whole hash array is cleared
+                bool Clear(size_t n)
+                {
+                    if (n > capacity - cleared)
+                        n = capacity - cleared;
+                    memset(hashes + cleared, 0, n * sizeof(uint32_t));
+                    cleared += n;
+                    return cleared == capacity;
+                }
+                void Release()
+                {
+                    for (size_t i = 0; size && i < capacity; i++)
+                    {
+                        if (hashes[i] > HASH_MOVED)
+                        {
+                            values[i].~Value();
+                            size--;
+                        }
+                    }
+                    free(hashes);
+                    free(keys);
+                    free(values);
+                    hashes = NULL;
+                    keys = NULL;
+                    values = NULL;
+                    mask = 0;
+                    size = 0;
+                    capacity = 0;
+                    cleared = 0;
+                    trimmed = 0;
+                }
+                // Drops the key and value pages of slots [0, n) that are done
+                // with, so freeing a large migrated table does not unmap it all
+                // at once. The hashes stay: a dropped page reads back as
+                // HASH_EMPTY instead of HASH_MOVED and would cut the probe
+                // chains of entries past the cursor whose home slot is in it.
+                void Trim(size_t n)
+                {
+                    if (n < trimmed + TRIM_STEP)
+                        return;
+                    DropPages(keys, trimmed * sizeof(TFTPEndpoint), n * sizeof(TFTPEndpoint));
+                    DropPages(values, trimmed * sizeof(Value), n * sizeof(Value));
+                    trimmed = n;
+                }
+                // large arrays start on a page, so Trim() can drop whole pages
+                static void *Alloc(size_t bytes)
+                {
+                    void *p = NULL;
+                    if (bytes < PageSize())
+                        return malloc(bytes);
+                    return posix_memalign(&p, PageSize(), bytes) ? NULL : p;
+                }
+                static uintptr_t PageSize()
+                {
+                    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+                    return page;
+                }
+                static void DropPages(void *base, size_t from, size_t to)
+                {
+                    uintptr_t page = PageSize();
+                    uintptr_t begin = ((uintptr_t)base + from + page - 1) & ~(page - 1);
+                    uintptr_t end = ((uintptr_t)base + to) & ~(page - 1);
+                    if (begin < end)
+                        madvise((void *)begin, end - begin, MADV_DONTNEED);
+                }
+                void Swap(Table &o)
+                {
+                    std::swap(hashes, o.hashes);
+                    std::swap(keys, o.keys);
+                    std::swap(values, o.values);
+                    std::swap(mask, o.mask);
+                    std::swap(size, o.size);
+                    std::swap(capacity, o.capacity);
+                    std::swap(cleared, o.cleared);
+                    std::swap(trimmed, o.trimmed);
+                }
+                size_t Capacity() const
+                {
+                    return capacity;
+                }
+                uint32_t Distance(uint32_t idx) const
+                {
+                    return (idx - (hashes[idx] & mask)) & mask;
+                }
+
+                int64_t Find(const TFTPEndpoint &key, uint32_t h) const
+                {
+                    if (!capacity)
+                        return -1;
+
+                    uint32_t idx = h & mask;
+                    for (uint32_t dist = 0; dist <= mask; dist++, idx = (idx + 1) & mask)
+                    {
+                        uint32_t cur = hashes[idx];
+                        if (cur == HASH_EMPTY)
+                            return -1;
+                        if (cur == HASH_MOVED)
+                            continue;
+                        if (Distance(idx) < dist)
+                            return -1;
+                        if (cur == h && keys[idx] == key)
+                            return idx;
+                    }
+                    return -1;
+                }
+
+                // key must not be present, the table must not hold moved slots
+                uint32_t Insert(const TFTPEndpoint &key, uint32_t h, const Value &value)
+                {
+                    TFTPEndpoint k = key;
+                    Value v = value;
+                    uint32_t idx = h & mask, dist = 0;
+                    int64_t placed = -1;
+
+                    size++;
+                    for (;; dist++, idx = (idx + 1) & mask)
+                    {
+                        if (hashes[idx] == HASH_EMPTY)
+                        {
+                            hashes[idx] = h;
+                            new (&keys[idx]) TFTPEndpoint(k);
+                            new (&values[idx]) Value(v);
+                            return placed < 0 ? idx : placed;
+                        }
+
+                        uint32_t existing = Distance(idx);
+                        if (existing < dist)
+                        {
+                            std::swap(hashes[idx], h);
+                            std::swap(keys[idx], k);
+                            std::swap(values[idx], v);
+                            if (placed < 0)
+                                placed = idx;
+                            dist = existing;
+                        }
+                    }
+                }
+
+                // backward shift, keeps probe sequences short without tombstones
+                void Erase(uint32_t idx)
+                {
+                    size--;
+                    for (uint32_t next = (idx + 1) & mask;; idx = next, next = (next + 1) & mask)
+                    {
+                        if (hashes[next] == HASH_EMPTY || Distance(next) == 0)
+                        {
+                            hashes[idx] = HASH_EMPTY;
+                            values[idx].~Value();
+                            return;
+                        }
+                        hashes[idx] = hashes[next];
+                        keys[idx] = keys[next];
+                        values[idx] = values[next];
+                    }
+                }
+
+                // used on the table being migrated away from
+                void MarkMoved(uint32_t idx)
+                {
+                    size--;
+                    hashes[idx] = HASH_MOVED;
+                    values[idx].~Value();
+                }
+            };
+
+            Table m_cur;
+            Table m_old;
+            Table m_next;
+            size_t m_cursor;
+
+            TFTPSessionTable(const TFTPSessionTable &);
+            TFTPSessionTable &operator=(const TFTPSessionTable &);
+
+        public:
+            TFTPSessionTable(size_t capacity = MIN_CAPACITY) : m_cursor(0)
+            {
+                size_t n = MIN_CAPACITY;
+                while (n < capacity)
+                    n <<= 1;
+                m_cur.Allocate(n);
+                m_cur.Clear(n);
+            }
+
+            size_t Size() const
+            {
+                return m_cur.size + m_old.size;
+            }
+            size_t Capacity() const
+            {
+                return m_cur.Capacity();
+            }
+            bool Migrating() const
+            {
+                return m_old.Capacity() > 0;
+            }
+
+            Value *Find(const TFTPEndpoint &key)
+            {
+                uint32_t h = HashOf(key);
+                int64_t idx = m_cur.Find(key, h);
+                if (idx >= 0)
+                    return &m_cur.values[idx];
+                idx = m_old.Find(key, h);
+                if (idx >= 0)
+                    return &m_old.values[idx];
+                return NULL;
+            }
+            const Value *Find(const TFTPEndpoint &key) const
+            {
+                return const_cast<TFTPSessionTable *>(this)->Find(key);
+            }
+
+            // Returns the value for key, default constructed when it is new.
+            Value *Insert(const TFTPEndpoint &key, bool *inserted = NULL)
+            {
+                Migrate();
+                Prepare();
+
+                uint32_t h = HashOf(key);
+                int64_t idx = m_cur.Find(key, h);
+                if (idx < 0 && Migrating())
+                {
+                    idx = m_old.Find(key, h);
+                    if (idx >= 0)
+                    {
+                        if (inserted)
+                            *inserted = false;
+                        return &m_old.values[idx];
+                    }
+                }
+                if (inserted)
+                    *inserted = idx < 0;
+                if (idx >= 0)
+                    return &m_cur.values[idx];
+
+                // load factor 7/8, finish a pending migration before growing again
+                if ((m_cur.size + 1) * 8 > m_cur.Capacity() * 7)
+                {
+                    while (Migrating())
+                        Migrate();
+                    Grow();
+                }
+                return &m_cur.values[m_cur.Insert(key, h, Value())];
+            }
+
+            bool Erase(const TFTPEndpoint &key)
+            {
+                Migrate();
+                Prepare();
+
+                uint32_t h = HashOf(key);
+                int64_t idx = m_cur.Find(key, h);
+                if (idx >= 0)
+                {
+                    m_cur.Erase(idx);
+                    return true;
+                }
+                idx = m_old.Find(key, h);
+                if (idx >= 0)
+                {
+                    m_old.MarkMoved(idx);
+                    return true;
+                }
+                return false;
+            }
+
+            // Visits every entry, fn(const TFTPEndpoint &, Value &).
+            template <typename Fn>
+            void ForEach(Fn fn)
+            {
+                Table *tables[2] = {&m_cur, &m_old};
+                for (int t = 0; t < 2; t++)
+                {
+                    for (size_t i = 0; i < tables[t]->Capacity(); i++)
+                    {
+                        if (tables[t]->hashes[i] > HASH_MOVED)
+                            fn(tables[t]->keys[i], tables[t]->values[i]);
+                    }
+                }
+            }
+
+        private:
+            static uint32_t HashOf(const TFTPEndpoint &key)
+            {
+                uint32_t h = key.Hash();
+                return h > HASH_MOVED ? h : h + 2;
+            }
+
+            // allocates and clears the next table ahead of Grow()
+            void Prepare()
+            {
+                if (!m_next.Capacity())
+                {
+                    if (m_cur.size * 4 >= m_cur.Capacity() * 3)
+                        m_next.Allocate(m_cur.Capacity() * 2);
+                    return;
+                }
+                m_next.Clear(CLEAR_STEP);
+            }
+
+            void Grow()
+            {
+                // only when inserts outran Prepare()
+                if (!m_next.Capacity())
+                    m_next.Allocate(m_cur.Capacity() * 2);
+                m_next.Clear(m_next.Capacity());
+
+                m_old.Swap(m_cur);
+                m_cur.Swap(m_next);
+                m_cursor = 0;
+            }
+
+            void Migrate()
+            {
+                if (!Migrating())
+                    return;
+
+                for (uint32_t n = 0; n < MIGRATE_STEP && m_cursor < m_old.Capacity(); n++, m_cursor++)
+                {
+                    uint32_t h = m_old.hashes[m_cursor];
+                    if (h > HASH_MOVED)
+                    {
+                        m_cur.Insert(m_old.keys[m_cursor], h, m_old.values[m_cursor]);
+                        m_old.MarkMoved(m_cursor);
+                    }
+                }
+                if (m_cursor >= m_old.Capacity() || !m_old.size)
+                    m_old.Release();
+                else
+                    m_old.Trim(m_cursor);
+            }
+        };
+    }
+}
+#endif
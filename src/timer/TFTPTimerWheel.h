@@ -0,0 +1,320 @@
+#ifndef _OMS_TIMER_TFTP_TIMER_WHEEL_H
+#define _OMS_TIMER_TFTP_TIMER_WHEEL_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+namespace oms
+{
+    namespace timer
+    {
+        // Hierarchical timing wheel for retransmit and expiry timers.
+        //
+        // Time is counted in ticks of whatever length the event loop drives
+        // Advance() with. Level 0 has 256 one tick slots, the four upper levels
+        // have 64 slots each covering 2^8, 2^14, 2^20 and 2^26 ticks; timers in
+        // an upper slot are cascaded down when level 0 wraps. Arm, Rearm and
+        // Cancel are O(1), an ACK moving a retransmit timer is one unlink and
+        // one link. Advance() skips idle stretches a cascade period at a time.
+        //
+        // Timers are identified by a non zero handle that stays valid until the
+        // timer fires or is cancelled, so it fits TFTPSessionHot::timerSlot.
+        // The low INDEX_BITS pick the node, the rest is a generation bumped
+        // every time the node is released, so a stale handle kept after its
+        // timer fired does not reach the timer that reuses the node.
+        class TFTPTimerWheel
+        {
+            enum
+            {
+                LEVEL0_BITS = 8,
+                LEVEL_BITS = 6,
+                LEVELS = 5,
+                LEVEL0_SIZE = 1 << LEVEL0_BITS,
+                LEVEL_SIZE = 1 << LEVEL_BITS,
+                SLOTS = LEVEL0_SIZE + (LEVELS - 1) * LEVEL_SIZE,
+                FIRING = SLOTS,
+                HEADS = SLOTS + 1,
+                NIL = 0xFFFFFFFFu,
+                INDEX_BITS = 24,
+                INDEX_MASK = (1u << INDEX_BITS) - 1,
+            };
+
+            struct Node
+            {
+                uint64_t expires;
+                uint64_t data;
+                uint32_t prev;
+                uint32_t next;
+                uint32_t slot; // NIL when not armed
+                uint32_t gen;
+            };
+
+            // nodes [0, SLOTS) are the list heads of the slots, FIRING holds
+            // the batch of the tick being run
+            std::vector<Node> m_nodes;
+            uint32_t m_free;
+            uint64_t m_current;
+            size_t m_pending;
+            size_t m_count[LEVELS + 1]; // timers linked per level
+
+            TFTPTimerWheel(const TFTPTimerWheel &);
+            TFTPTimerWheel &operator=(const TFTPTimerWheel &);
+
+        public:
+            TFTPTimerWheel(uint64_t now = 0, size_t reserve = 0) : m_free(NIL), m_current(now), m_pending(0)
+            {
+                memset(m_count, 0, sizeof(m_count));
+                m_nodes.reserve(HEADS + reserve);
+                m_nodes.resize(HEADS);
+                for (uint32_t i = 0; i < HEADS; i++)
+                {
+                    m_nodes[i].expires = 0;
+                    m_nodes[i].data = 0;
+                    m_nodes[i].prev = m_nodes[i].next = i;
+                    m_nodes[i].slot = i;
+                    m_nodes[i].gen = 0;
+                }
+            }
+
+            uint64_t Current() const
+            {
+                return m_current;
+            }
+            size_t Pending() const
+            {
+                return m_pending;
+            }
+            bool Armed(uint32_t handle) const
+            {
+                uint32_t id = handle & INDEX_MASK;
+                return id >= HEADS && id < m_nodes.size() && m_nodes[id].slot != NIL &&
+                       m_nodes[id].gen == handle >> INDEX_BITS;
+            }
+            uint64_t Expires(uint32_t handle) const
+            {
+                return Armed(handle) ? m_nodes[handle & INDEX_MASK].expires : 0;
+            }
+
+            // A timer already due fires on the next Advance(). Returns 0 when
+            // 2^INDEX_BITS timers are armed.
+            uint32_t Arm(uint64_t expires, uint64_t data)
+            {
+                uint32_t id = m_free;
+                if (id != NIL)
+                {
+                    m_free = m_nodes[id].next;
+                }
+                else
+                {
+                    if (m_nodes.size() > INDEX_MASK)
+                        return 0;
+                    id = m_nodes.size();
+                    m_nodes.push_back(Node());
+                    m_nodes[id].gen = 0;
+                }
+
+                Node &n = m_nodes[id];
+                n.expires = expires;
+                n.data = data;
+                Place(id);
+                m_pending++;
+                return Handle(id);
+            }
+
+            bool Rearm(uint32_t handle, uint64_t expires)
+            {
+                if (!Armed(handle))
+                    return false;
+                uint32_t id = handle & INDEX_MASK;
+                Unlink(id);
+                m_nodes[id].expires = expires;
+                Place(id);
+                return true;
+            }
+
+            bool Cancel(uint32_t handle)
+            {
+                if (!Armed(handle))
+                    return false;
+                uint32_t id = handle & INDEX_MASK;
+                Unlink(id);
+                Release(id);
+                m_pending--;
+                return true;
+            }
+
+            // Runs every tick up to and including now and calls
+            // fn(uint32_t handle, uint64_t data) for each expired timer. The
+            // handle is already released when fn runs; fn may arm new timers.
+            // Returns the number of timers fired.
+            template <typename Fn>
+            size_t Advance(uint64_t now, Fn fn)
+            {
+                size_t fired = 0;
+                while (m_current <= now)
+                {
+                    if (!m_pending)
+                    {
+                        m_current = now + 1;
+                        break;
+                    }
+
+                    uint32_t idx = m_current & (LEVEL0_SIZE - 1);
+                    if (!idx)
+                    {
+                        for (uint32_t level = 1; level < LEVELS; level++)
+                        {
+                            uint32_t i = (m_current >> Shift(level)) & (LEVEL_SIZE - 1);
+                            Cascade(Head(level, i));
+                            if (i)
+                                break;
+                        }
+                    }
+
+                    // nothing due at level 0: jump to the next tick that
+                    // cascades the lowest level holding timers
+                    if (!m_count[0])
+                    {
+                        uint32_t level = 1;
+                        while (level < LEVELS - 1 && !m_count[level])
+                            level++;
+                        uint64_t next = (m_current | ((1ull << Shift(level)) - 1)) + 1;
+                        m_current = next <= now ? next : now + 1;
+                        continue;
+                    }
+
+                    // current moves on before the callbacks, a timer armed
+                    // for a past tick from fn lands in the next slot to run
+                    m_current++;
+                    Splice(idx, FIRING);
+                    while (m_nodes[FIRING].next != FIRING)
+                    {
+                        uint32_t id = m_nodes[FIRING].next;
+                        uint32_t handle = Handle(id);
+                        uint64_t data = m_nodes[id].data;
+                        Unlink(id);
+                        Release(id);
+                        m_pending--;
+                        fired++;
+                        fn(handle, data);
+                    }
+                }
+                return fired;
+            }
+
+        private:
+            uint32_t Handle(uint32_t id) const
+            {
+                return m_nodes[id].gen << INDEX_BITS | id;
+            }
+            static uint32_t Shift(uint32_t level)
+            {
+                return LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+            }
+            static uint32_t Head(uint32_t level, uint32_t i)
+            {
+                return LEVEL0_SIZE + (level - 1) * LEVEL_SIZE + i;
+            }
+            // FIRING counts as level LEVELS
+            static uint32_t Level(uint32_t head)
+            {
+                if (head < LEVEL0_SIZE)
+                    return 0;
+                return 1 + (head - LEVEL0_SIZE) / LEVEL_SIZE;
+            }
+
+            void Place(uint32_t id)
+            {
+                uint64_t expires = m_nodes[id].expires;
+                if (expires < m_current)
+                    expires = m_current;
+
+                uint64_t delta = expires - m_current;
+                if (delta < LEVEL0_SIZE)
+                {
+                    Link(id, expires & (LEVEL0_SIZE - 1));
+                    return;
+                }
+
+                // further than the top level covers: park in its last slot
+                // and cascade down again later
+                uint64_t max = (1ull << (Shift(LEVELS - 1) + LEVEL_BITS)) - (1ull << Shift(LEVELS - 1)) - 1;
+                if (delta > max)
+                    expires = m_current + max;
+
+                for (uint32_t level = 1; level < LEVELS; level++)
+                {
+                    if (level == LEVELS - 1 || delta < (1ull << (Shift(level) + LEVEL_BITS)))
+                    {
+                        Link(id, Head(level, (expires >> Shift(level)) & (LEVEL_SIZE - 1)));
+                        return;
+                    }
+                }
+            }
+
+            void Cascade(uint32_t head)
+            {
+                // detach the whole list first, Place() may link into head again
+                Splice(head, FIRING);
+                while (m_nodes[FIRING].next != FIRING)
+                {
+                    uint32_t id = m_nodes[FIRING].next;
+                    Unlink(id);
+                    Place(id);
+                }
+            }
+
+            // moves the whole list of from to the empty list to
+            void Splice(uint32_t from, uint32_t to)
+            {
+                if (m_nodes[from].next == from)
+                    return;
+
+                uint32_t first = m_nodes[from].next;
+                uint32_t last = m_nodes[from].prev;
+                m_nodes[from].next = m_nodes[from].prev = from;
+
+                m_nodes[to].next = first;
+                m_nodes[to].prev = last;
+                m_nodes[first].prev = to;
+                m_nodes[last].next = to;
+                for (uint32_t id = first; id != to; id = m_nodes[id].next)
+                {
+                    m_nodes[id].slot = to;
+                    m_count[Level(from)]--;
+                    m_count[Level(to)]++;
+                }
+            }
+
+            void Link(uint32_t id, uint32_t head)
+            {
+                Node &n = m_nodes[id];
+                Node &h = m_nodes[head];
+                n.prev = h.prev;
+                n.next = head;
+                n.slot = head;
+                m_nodes[h.prev].next = id;
+                h.prev = id;
+                m_count[Level(head)]++;
+            }
+            void Unlink(uint32_t id)
+            {
+                Node &n = m_nodes[id];
+                m_nodes[n.prev].next = n.next;
+                m_nodes[n.next].prev = n.prev;
+                m_count[Level(n.slot)]--;
+                n.slot = NIL;
+            }
+            void Release(uint32_t id)
+            {
+                m_nodes[id].gen = (m_nodes[id].gen + 1) & (0xFFFFFFFFu >> INDEX_BITS);
+                m_nodes[id].next = m_free;
+                m_free = id;
+            }
+        };
+    }
+}
+#endif
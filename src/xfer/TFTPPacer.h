@@ -0,0 +1,242 @@
+#ifndef _OMS_XFER_TFTP_PACER_H
+#define _OMS_XFER_TFTP_PACER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "limit/TFTPRateLimiter.h"
+
+namespace oms
+{
+    namespace xfer
+    {
+        // Spreads the DATA of a window over time instead of bursting it at
+        // line rate into a shallow switch buffer.
+        //
+        // The rate follows the ACK clock. A round is what was sent since the
+        // previous ACK. When the ACK arrives, the round's bytes divided by the
+        // time they took to get through the path give a delivery rate
+        // sample. That time is the longer of how long sending took and
+        // ack time - first send - min RTT, i.e. how long the bottleneck needed
+        // to drain the round; a lone packet gives no sample. The bottleneck
+        // estimate is the max of the last FILTER_ROUNDS samples. The pacing
+        // rate is that estimate times a gain: 2 during startup, until the
+        // estimate stops growing, then cycling 5/4, 3/4 and six rounds of 1
+        // to probe for more bandwidth and drain the queue probing built.
+        //
+        // Times are in microseconds, rates in bytes per second. Before each
+        // DATA call Delay(); send only when it returns 0, then call OnSend().
+        // Otherwise arm a timer for the delay it returned.
+        class TFTPPacer
+        {
+        public:
+            enum
+            {
+                MIN_RATE = 16 * 1024,
+                FILTER_ROUNDS = 10,
+                STARTUP_ROUNDS = 3,
+                GAIN_CYCLE = 8,
+            };
+
+        private:
+            limit::TFTPTokenBucket m_bucket;
+            uint32_t m_rate;
+            uint32_t m_maxRate;
+            uint32_t m_quantum;
+
+            bool m_open;
+            uint64_t m_firstSend;
+            uint64_t m_lastSend;
+            uint32_t m_packets;
+            uint64_t m_minRtt;
+
+            uint32_t m_samples[FILTER_ROUNDS];
+            uint32_t m_btlBw;
+            uint64_t m_rounds;
+            bool m_startup;
+            uint32_t m_fullBw;
+            uint32_t m_fullCount;
+            uint32_t m_applied;
+
+        public:
+            // quantum: bytes that may leave back to back, at least a packet
+            TFTPPacer(uint32_t initialRate, uint32_t quantum = 3000, uint32_t maxRate = UINT32_MAX)
+                : m_maxRate(maxRate < MIN_RATE ? (uint32_t)MIN_RATE : maxRate), m_quantum(quantum),
+                  m_open(false), m_firstSend(0), m_lastSend(0), m_packets(0), m_minRtt(UINT64_MAX), m_btlBw(0),
+                  m_rounds(0), m_startup(true), m_fullBw(0), m_fullCount(0), m_applied(0)
+            {
+                memset(m_samples, 0, sizeof(m_samples));
+                m_rate = Clamp(initialRate);
+                m_bucket.Reset(quantum, 0);
+            }
+
+            uint32_t Rate() const
+            {
+                return m_rate;
+            }
+            uint32_t BottleneckRate() const
+            {
+                return m_btlBw;
+            }
+            uint64_t MinRtt() const
+            {
+                return m_minRtt;
+            }
+            bool Startup() const
+            {
+                return m_startup;
+            }
+
+            // microseconds until a packet of bytes may leave
+            uint64_t Delay(uint32_t bytes, uint64_t nowUs)
+            {
+                uint32_t burst = bytes > m_quantum ? bytes : m_quantum;
+                m_bucket.Refill(m_rate / 1000, burst, nowUs);
+                return m_bucket.Wait(m_rate / 1000, (uint64_t)bytes * limit::TFTPTokenBucket::SCALE);
+            }
+
+            void OnSend(uint32_t bytes, uint64_t nowUs)
+            {
+                m_bucket.Take((uint64_t)bytes * limit::TFTPTokenBucket::SCALE);
+                if (!m_open)
+                {
+                    m_open = true;
+                    m_firstSend = nowUs;
+                    m_packets = 0;
+                }
+                m_packets++;
+                m_lastSend = nowUs;
+            }
+
+            // bytes: DATA newly acknowledged by this ACK
+            void OnAck(uint64_t bytes, uint64_t nowUs)
+            {
+                if (!m_open || nowUs < m_lastSend)
+                    return;
+                m_open = false;
+
+                uint64_t rtt = nowUs - m_lastSend;
+                if (rtt < m_minRtt)
+                    m_minRtt = rtt;
+                if (!bytes || m_packets < 2)
+                    return;
+
+                // min RTT already holds one packet's trip through the
+                // bottleneck, the drain time covers the other ones
+                bytes = bytes * (m_packets - 1) / m_packets;
+                uint64_t interval = m_lastSend - m_firstSend;
+                uint64_t drain = nowUs - m_firstSend - m_minRtt;
+                if (drain > interval)
+                    interval = drain;
+                if (!interval)
+                    interval = 1;
+                uint64_t sample = bytes * 1000000 / interval;
+                m_samples[m_rounds++ % FILTER_ROUNDS] = sample > UINT32_MAX ? UINT32_MAX : (uint32_t)sample;
+
+                m_btlBw = 0;
+                for (size_t i = 0; i < FILTER_ROUNDS; i++)
+                {
+                    if (m_samples[i] > m_btlBw)
+                        m_btlBw = m_samples[i];
+                }
+
+                if (m_startup)
+                {
+                    if ((uint64_t)m_btlBw * 4 >= (uint64_t)m_fullBw * 5)
+                    {
+                        m_fullBw = m_btlBw;
+                        m_fullCount = 0;
+                    }
+                    else if (++m_fullCount >= STARTUP_ROUNDS)
+                        m_startup = false;
+                }
+                Update();
+            }
+
+            // The retransmit timer fired, the round is lost and the path
+            // holds less than thought: halve the rate and stop probing.
+            void OnTimeout()
+            {
+                m_open = false;
+                m_startup = false;
+                m_rate = Clamp(m_rate / 2);
+                for (size_t i = 0; i < FILTER_ROUNDS; i++)
+                    m_samples[i] = m_rate;
+                m_btlBw = m_rate;
+            }
+
+            // Hands the rate to the kernel as SO_MAX_PACING_RATE, which the fq
+            // qdisc enforces per socket with its own timers. Only worth it
+            // on a connected per-session socket. Skips changes below 1/8.
+            int32_t ApplySocket(int fd)
+            {
+                uint32_t diff = m_rate > m_applied ? m_rate - m_applied : m_applied - m_rate;
+                if (m_applied && diff < m_applied / 8)
+                    return 0;
+                unsigned int rate = m_rate;
+                if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) < 0)
+                    return -1;
+                m_applied = m_rate;
+                return 0;
+            }
+
+        private:
+            uint32_t Clamp(uint64_t rate) const
+            {
+                if (rate < MIN_RATE)
+                    return MIN_RATE;
+                return rate > m_maxRate ? m_maxRate : (uint32_t)rate;
+            }
+
+            void Update()
+            {
+                // gains in quarters
+                static const uint32_t cycle[GAIN_CYCLE] = {5, 3, 4, 4, 4, 4, 4, 4};
+                uint32_t gain = m_startup ? 8 : cycle[m_rounds % GAIN_CYCLE];
+                m_rate = Clamp((uint64_t)m_btlBw * gain / 4);
+            }
+        };
+
+        // Server wide cap on DATA bytes per second, shared by all sessions
+        // of one event loop so the server cannot fill the site uplink. A
+        // packet goes out only when both its session pacer and the cap
+        // allow it.
+        class TFTPBandwidthCap
+        {
+            limit::TFTPTokenBucket m_bucket;
+            uint32_t m_rate;
+            uint32_t m_burst;
+
+            TFTPBandwidthCap(const TFTPBandwidthCap &);
+            TFTPBandwidthCap &operator=(const TFTPBandwidthCap &);
+
+        public:
+            // rate: bytes per second, burst: bytes, at least a packet
+            TFTPBandwidthCap(uint32_t rate, uint32_t burst)
+                : m_rate(rate < TFTPPacer::MIN_RATE ? (uint32_t)TFTPPacer::MIN_RATE : rate), m_burst(burst)
+            {
+                m_bucket.Reset(burst, 0);
+            }
+
+            uint32_t Rate() const
+            {
+                return m_rate;
+            }
+
+            uint64_t Delay(uint32_t bytes, uint64_t nowUs)
+            {
+                uint32_t burst = bytes > m_burst ? bytes : m_burst;
+                m_bucket.Refill(m_rate / 1000, burst, nowUs);
+                return m_bucket.Wait(m_rate / 1000, (uint64_t)bytes * limit::TFTPTokenBucket::SCALE);
+            }
+
+            void OnSend(uint32_t bytes)
+            {
+                m_bucket.Take((uint64_t)bytes * limit::TFTPTokenBucket::SCALE);
+            }
+        };
+    }
+}
+#endif
@@ -0,0 +1,291 @@
+#ifndef _OMS_XFER_TFTP_RESUME_H
+#define _OMS_XFER_TFTP_RESUME_H
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <vector>
+
+#include "msg/TFTPOption.h"
+
+namespace oms
+{
+    namespace xfer
+    {
+        // crc32 of prefixes of one file, remembered every STEP bytes. Checking
+        // a resume offset reads the whole prefix once; later checks against
+        // the same image only read from the nearest mark. Keep one per
+        // served image or partial upload next to its fd, not thread safe.
+        // When the file is cut or rewritten below some length, Truncate()
+        // to it.
+        class TFTPPrefixCrc
+        {
+            int m_fd;
+            std::vector<uint32_t> m_marks; // m_marks[i]: crc of [0, i * STEP)
+
+        public:
+            enum
+            {
+                STEP = 1 << 20,
+            };
+
+            TFTPPrefixCrc(int fd) : m_fd(fd), m_marks(1, crc32(0L, Z_NULL, 0))
+            {
+            }
+
+            int Fd() const
+            {
+                return m_fd;
+            }
+            // forgets the marks past len
+            void Truncate(uint64_t len)
+            {
+                if (m_marks.size() > len / STEP + 1)
+                    m_marks.resize(len / STEP + 1);
+            }
+
+            int32_t Crc(uint64_t len, uint32_t &crc)
+            {
+                uint64_t mark = len / STEP;
+                while (m_marks.size() <= mark)
+                {
+                    uint32_t c = m_marks.back();
+                    if (Extend(m_fd, (m_marks.size() - 1) * (uint64_t)STEP, STEP, c) < 0)
+                        return -1;
+                    m_marks.push_back(c);
+                }
+                crc = m_marks[mark];
+                return Extend(m_fd, mark * STEP, len - mark * STEP, crc);
+            }
+
+            // continues crc over [off, off + len) of fd
+            static int32_t Extend(int fd, uint64_t off, uint64_t len, uint32_t &crc)
+            {
+                uint8_t cache[64 * 1024];
+                for (uint64_t end = off + len; off < end;)
+                {
+                    size_t n = end - off < sizeof(cache) ? (size_t)(end - off) : sizeof(cache);
+                    ssize_t ret = pread(fd, cache, n, off);
+                    if (ret <= 0)
+                        return -1;
+                    crc = crc32(crc, cache, ret);
+                    off += ret;
+                }
+                return 0;
+            }
+        };
+
+        // Resuming a transfer from a byte offset.
+        //
+        // The requester puts "resume" (number of bytes the receiving side
+        // already holds) in the RRQ/WRQ options, the server answers with the
+        // offset it accepts in the OACK, always a whole number of blocks of
+        // the blksize negotiated this time, and DATA continues at block index
+        // resume / blksize, i.e. block number (index + 1) & 0xFFFF. Counting
+        // in bytes keeps the offset valid when the blksize changes between
+        // attempts, as it does when the path MTU estimate steps down.
+        //
+        // RRQ: the client adds "rsum", the crc32 of all the bytes it holds,
+        //      and the server only confirms the offset if its own prefix
+        //      matches. The client drops what it holds past the offset.
+        // WRQ: "resume" is an upper bound; the server confirms what it holds of
+        //      the partial file together with the "rsum" of that prefix, and
+        //      the client must check it against its source before sending.
+        //
+        // A confirmed offset of 0 means start over from the first block.
+        class TFTPResume
+        {
+        public:
+            static uint32_t Checksum(const uint8_t *buf, uint64_t len, uint32_t crc = 0)
+            {
+                while (len > 0)
+                {
+                    uInt n = len > 0x40000000 ? 0x40000000 : (uInt)len;
+                    crc = crc32(crc, buf, n);
+                    buf += n;
+                    len -= n;
+                }
+                return crc;
+            }
+            static int32_t Checksum(int fd, uint64_t len, uint32_t &crc)
+            {
+                crc = crc32(0L, Z_NULL, 0);
+                return TFTPPrefixCrc::Extend(fd, 0, len, crc);
+            }
+
+            static uint16_t BlockNumber(uint64_t index)
+            {
+                return (index + 1) & 0xFFFF;
+            }
+
+            // client side, RRQ: bytes held and their crc
+            static void Offer(msg::TFTPOpts &opts, uint64_t bytes, uint32_t sum)
+            {
+                Offer(opts, bytes);
+                char cache[16] = {0};
+                snprintf(cache, sizeof(cache), "%08x", sum);
+                opts.insert(TFTP_OPT_RESUME_SUM, cache);
+            }
+            // client side, WRQ: bytes of the source
+            static void Offer(msg::TFTPOpts &opts, uint64_t bytes)
+            {
+                msg::TFTPOpt opt(TFTP_OPT_RESUME, "");
+                opt.SetValue(bytes);
+                opts.insert(opt);
+            }
+
+            // Server side of an RRQ for a file of fileSize bytes. Returns the
+            // block index to start from, -1 on a malformed option or read
+            // error. Nothing is added to the OACK when resume was not asked.
+            //
+            // Verifying rsum reads the client's whole prefix with blocking
+            // preads, 360 MB for a 400 MB image resumed at 90%. Pass the
+            // image's TFTPPrefixCrc so a storm of resumes reads each region
+            // once, or call this from a worker thread.
+            static int64_t AcceptRead(const msg::TFTPOpts &req, msg::TFTPOpts &oack,
+                                      TFTPPrefixCrc &sums, uint64_t fileSize, uint16_t blkSize)
+            {
+                uint64_t bytes = 0;
+                uint32_t sum = 0;
+                int32_t ret = Parse(req, bytes, &sum);
+                if (ret <= 0)
+                    return ret;
+                if (!blkSize)
+                    return -1;
+
+                // without rsum there is nothing to check the client's copy
+                // against; rsum covers all it holds, which may end inside a
+                // block of this attempt's blksize
+                if (bytes > fileSize || ret != 2)
+                    bytes = 0;
+                if (bytes)
+                {
+                    uint32_t crc = 0;
+                    if (sums.Crc(bytes, crc) < 0)
+                        return -1;
+                    if (crc != sum)
+                        bytes = 0;
+                }
+                Confirm(oack, bytes / blkSize * blkSize);
+                return bytes / blkSize;
+            }
+            static int64_t AcceptRead(const msg::TFTPOpts &req, msg::TFTPOpts &oack,
+                                      int fd, uint64_t fileSize, uint16_t blkSize)
+            {
+                TFTPPrefixCrc sums(fd);
+                return AcceptRead(req, oack, sums, fileSize, blkSize);
+            }
+
+            // Server side of a WRQ onto the partial file on fd. The partial
+            // file is truncated to the confirmed prefix.
+            //
+            // The rsum of that prefix is read with blocking preads just like
+            // in AcceptRead(). Keep the upload's TFTPPrefixCrc across its
+            // attempts, a retried WRQ then only reads what arrived since the
+            // last one; or call this from a worker thread.
+            static int64_t AcceptWrite(const msg::TFTPOpts &req, msg::TFTPOpts &oack,
+                                       TFTPPrefixCrc &sums, uint16_t blkSize)
+            {
+                int fd = sums.Fd();
+                uint64_t bytes = 0;
+                int32_t ret = Parse(req, bytes, NULL);
+                if (ret <= 0)
+                    return ret;
+                if (!blkSize)
+                    return -1;
+
+                off_t size = lseek(fd, 0, SEEK_END);
+                if (size < 0)
+                    return -1;
+                if (bytes > (uint64_t)size)
+                    bytes = size;
+                uint64_t blocks = bytes / blkSize;
+
+                uint32_t crc = 0;
+                if (sums.Crc(blocks * blkSize, crc) < 0 || ftruncate(fd, blocks * blkSize) < 0)
+                    return -1;
+                sums.Truncate(blocks * blkSize);
+
+                Confirm(oack, blocks * blkSize);
+                char cache[16] = {0};
+                snprintf(cache, sizeof(cache), "%08x", crc);
+                oack.insert(TFTP_OPT_RESUME_SUM, cache);
+                return blocks;
+            }
+            static int64_t AcceptWrite(const msg::TFTPOpts &req, msg::TFTPOpts &oack, int fd, uint16_t blkSize)
+            {
+                TFTPPrefixCrc sums(fd);
+                return AcceptWrite(req, oack, sums, blkSize);
+            }
+
+            // Client side: the block index confirmed by the server's OACK, 0
+            // when the server ignored the option, -1 when it is malformed,
+            // larger than offered or not a whole number of blocks.
+            static int64_t Confirmed(const msg::TFTPOpts &oack, uint64_t offered, uint16_t blkSize)
+            {
+                uint64_t bytes = 0;
+                int32_t ret = Parse(oack, bytes, NULL);
+                if (ret < 0 || bytes > offered || !blkSize || bytes % blkSize)
+                    return -1;
+                return bytes / blkSize;
+            }
+            // Client side of a WRQ: also checks the server's prefix against
+            // the local source on fd. Returns -1 on a mismatch, the transfer
+            // must then be restarted without resume.
+            static int64_t Confirmed(const msg::TFTPOpts &oack, uint64_t offered, int fd, uint16_t blkSize)
+            {
+                uint64_t bytes = 0;
+                uint32_t sum = 0, crc = 0;
+                int32_t ret = Parse(oack, bytes, &sum);
+                if (ret < 0 || bytes > offered || !blkSize || bytes % blkSize)
+                    return -1;
+                if (!bytes)
+                    return 0;
+                if (ret != 2 || Checksum(fd, bytes, crc) < 0 || crc != sum)
+                    return -1;
+                return bytes / blkSize;
+            }
+
+        private:
+            static void Confirm(msg::TFTPOpts &oack, uint64_t bytes)
+            {
+                msg::TFTPOpt opt(TFTP_OPT_RESUME, "");
+                opt.SetValue(bytes);
+                oack.insert(opt);
+            }
+
+            // 0: no resume, 1: resume only, 2: resume and rsum, -1: malformed
+            static int32_t Parse(const msg::TFTPOpts &opts, uint64_t &bytes, uint32_t *sum)
+            {
+                msg::TFTPOpts::const_iterator it = opts.find(TFTP_OPT_RESUME);
+                if (it == opts.end())
+                    return 0;
+
+                char *end = NULL;
+                const char *v = it->Value();
+                if (*v < '0' || *v > '9')
+                    return -1;
+                bytes = strtoull(v, &end, 10);
+                if (*end)
+                    return -1;
+
+                if (!sum)
+                    return 1;
+                it = opts.find(TFTP_OPT_RESUME_SUM);
+                if (it == opts.end())
+                    return 1;
+
+                v = it->Value();
+                unsigned long crc = strtoul(v, &end, 16);
+                if (!*v || *end || crc > 0xFFFFFFFFul)
+                    return -1;
+                *sum = crc;
+                return 2;
+            }
+        };
+    }
+}
+#endif
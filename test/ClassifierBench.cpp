@@ -0,0 +1,308 @@
+#include "msg/TFTPMessages.h"
+#include "msg/TFTPClassifier.h"
+#include "limit/TFTPRateLimiter.h"
+#include "TestCheck.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <vector>
+
+using namespace oms::msg;
+using namespace oms::limit;
+using namespace oms::session;
+
+struct Packet
+{
+    std::vector<uint8_t> buf;
+    bool knownTid;
+    bool legit;
+    TFTPEndpoint src;
+    uint64_t nowMs;
+};
+
+static std::vector<uint8_t> Encode(const TFTPMessage &msg)
+{
+    std::vector<uint8_t> buf(2048);
+    int32_t len = msg.Encode(&buf[0], buf.size());
+    CHECK(len > 0);
+    buf.resize(len);
+    return buf;
+}
+
+// What a flood looks like at port 69 and on the transfer ports: random
+// bytes, requests without terminators or with a bogus mode, and DATA and
+// ACK from senders that have no session.
+static Packet Flood(uint32_t &seed)
+{
+    Packet p;
+    p.knownTid = false;
+    p.legit = false;
+    seed = seed * 1103515245 + 12345;
+    switch ((seed >> 16) % 5)
+    {
+    case 0:
+    {
+        seed = seed * 1103515245 + 12345;
+        p.buf.resize(2 + (seed >> 16) % 600);
+        for (size_t i = 0; i < p.buf.size(); i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            p.buf[i] = seed >> 24;
+        }
+        break;
+    }
+    case 1:
+        p.buf.assign(512, 'A');
+        p.buf[1] = TFTP_OPCODE_RRQ;
+        p.buf[0] = 0;
+        break;
+    case 2:
+    {
+        const char rrq[] = "\0\1pxelinux.0\0binary\0blksize\0001428\0";
+        p.buf.assign(rrq, rrq + sizeof(rrq) - 1);
+        break;
+    }
+    case 3:
+    {
+        uint8_t payload[512] = {0};
+        p.buf = Encode(TFTPDataMessage(seed & 0xFFFF, payload, sizeof(payload)));
+        break;
+    }
+    default:
+        p.buf = Encode(TFTPAckMessage(seed & 0xFFFF));
+        break;
+    }
+    return p;
+}
+
+// the clients actually being served, ACKs of a read and DATA of a write
+static Packet Legit(uint32_t n)
+{
+    Packet p;
+    p.knownTid = true;
+    p.legit = true;
+    if (n & 1)
+    {
+        p.buf = Encode(TFTPAckMessage(n & 0xFFFF));
+    }
+    else
+    {
+        uint8_t payload[1428] = {0};
+        p.buf = Encode(TFTPDataMessage(n & 0xFFFF, payload, sizeof(payload)));
+    }
+    return p;
+}
+
+// the server without the classifier: pick the message by opcode and decode
+static bool Decode(const Packet &p)
+{
+    if (p.buf.size() < 2)
+        return false;
+    const uint8_t *buf = &p.buf[0];
+    uint32_t len = p.buf.size();
+    switch (buf[1] | (buf[0] << 8))
+    {
+    case TFTP_OPCODE_RRQ:
+    {
+        TFTPRReqMessage m;
+        return m.Decode(buf, len) > 0;
+    }
+    case TFTP_OPCODE_WRQ:
+    {
+        TFTPWReqMessage m;
+        return m.Decode(buf, len) > 0;
+    }
+    case TFTP_OPCODE_DATA:
+    {
+        TFTPDataMessage m;
+        return m.Decode(buf, len) > 0 && p.knownTid;
+    }
+    case FTFP_OPCODE_ACK:
+    {
+        TFTPAckMessage m;
+        return m.Decode(buf, len) > 0 && p.knownTid;
+    }
+    case TFTP_OPCODE_ERR:
+    {
+        TFTPErrMessage m;
+        return m.Decode(buf, len) > 0 && p.knownTid;
+    }
+    case TFTP_OPCODE_OACK:
+    {
+        TFTPOAckMessage m;
+        return m.Decode(buf, len) > 0 && p.knownTid;
+    }
+    default:
+        return false;
+    }
+}
+
+static bool Classified(const Packet &p)
+{
+    tftp_class_e c = TFTPClassifier::Classify(&p.buf[0], p.buf.size(), p.knownTid);
+    if (c != TFTP_CLASS_REQUEST && c != TFTP_CLASS_SESSION)
+        return false;
+    return Decode(p);
+}
+
+static double ElapsedUs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs the packets through one core, best of a few runs. Returns the
+// time in us and counts the packets let through.
+template <typename Fn>
+static double Run(const std::vector<Packet> &packets, Fn fn, size_t &accepted)
+{
+    double best = 1e18;
+    for (int run = 0; run < 5; run++)
+    {
+        accepted = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < packets.size(); i++)
+            accepted += fn(packets[i]);
+        double us = ElapsedUs(start);
+        if (us < best)
+            best = us;
+    }
+    return best;
+}
+
+// Well formed RRQs, the flood the classifier cannot shed on its own: a
+// few hosts sending from rotating ports at about 90k requests per second,
+// new clients booting now and then, and the transfers already running.
+// Packet times are simulated, 2 seconds of traffic.
+static std::vector<Packet> MakeRrqFlood(uint32_t count, size_t &sessionPackets, size_t &clients)
+{
+    std::vector<Packet> packets;
+    std::vector<uint8_t> rrq = Encode(TFTPRReqMessage("pxelinux.0", TFTP_MODE_OCTET));
+    uint32_t seed = 13;
+    sessionPackets = 0;
+    clients = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Packet p;
+        seed = seed * 1103515245 + 12345;
+        if (i % 10 == 9)
+        {
+            p = Legit(i);
+            p.src = TFTPEndpoint::FromIPv4(htonl(0x0A000000 | (i % 1000)), htons(2000));
+            sessionPackets++;
+        }
+        else if (i % 1000 == 0)
+        {
+            p.buf = rrq;
+            p.knownTid = false;
+            p.legit = true;
+            p.src = TFTPEndpoint::FromIPv4(htonl(0x0A010000 | (i / 1000)), htons(2000));
+            clients++;
+        }
+        else
+        {
+            p.buf = rrq;
+            p.knownTid = false;
+            p.legit = false;
+            p.src = TFTPEndpoint::FromIPv4(htonl(0xC0000201 + (seed >> 8) % 4), htons(1024 + (seed >> 12) % 60000));
+        }
+        p.nowMs = (uint64_t)i * 2000 / count;
+        packets.push_back(p);
+    }
+    return packets;
+}
+
+struct FloodResult
+{
+    double us;
+    size_t served;   // session packets decoded
+    size_t admitted; // requests past the limiter
+    size_t clients;  // of them from booting clients
+    uint64_t dropped;
+};
+
+// Classify, then requests go through the per source limiter and sessions
+// skip it. limited false decodes every well formed request instead.
+static FloodResult RunRrqFlood(const std::vector<Packet> &packets, bool limited)
+{
+    FloodResult best = {1e18, 0, 0, 0, 0};
+    for (int run = 0; run < 5; run++)
+    {
+        FloodResult r = {0, 0, 0, 0, 0};
+        TFTPRateLimiter limiter(10, 5, 4096);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < packets.size(); i++)
+        {
+            const Packet &p = packets[i];
+            tftp_class_e c = TFTPClassifier::Classify(&p.buf[0], p.buf.size(), p.knownTid);
+            if (c == TFTP_CLASS_SESSION)
+            {
+                r.served += Decode(p);
+            }
+            else if (c == TFTP_CLASS_REQUEST && (!limited || limiter.Allow(p.src, p.nowMs)) && Decode(p))
+            {
+                r.admitted++;
+                r.clients += p.legit;
+            }
+        }
+        r.us = ElapsedUs(start);
+        r.dropped = limiter.Dropped();
+        if (r.us < best.us)
+            best = r;
+    }
+    return best;
+}
+
+static void RrqFlood()
+{
+    size_t sessionPackets = 0, clients = 0;
+    std::vector<Packet> packets = MakeRrqFlood(200000, sessionPackets, clients);
+    FloodResult limited = RunRrqFlood(packets, true);
+    FloodResult open = RunRrqFlood(packets, false);
+
+    CHECK(limited.served == sessionPackets && open.served == sessionPackets);
+    CHECK(limited.clients == clients);
+    CHECK(limited.dropped > 0 && limited.admitted + limited.dropped == packets.size() - sessionPackets);
+
+    printf("RRQ flood: %zu requests, %zu from booting clients\n", packets.size() - sessionPackets, clients);
+    printf("  limiter: %llu dropped at %.2f M/s, %zu admitted (%zu of %zu clients), "
+           "%.2f Mpps/core of session traffic\n",
+           (unsigned long long)limited.dropped, limited.dropped / limited.us, limited.admitted, limited.clients,
+           clients, sessionPackets / limited.us);
+    printf("  none:    %zu admitted, %.2f Mpps/core of session traffic\n", open.admitted, sessionPackets / open.us);
+}
+
+int main()
+{
+    const uint32_t count = 200000;
+    uint32_t seed = 11;
+    std::vector<Packet> flood, mixed;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        flood.push_back(Flood(seed));
+        mixed.push_back(flood.back());
+        // one packet in ten is from a client being served
+        if (i % 9 == 0)
+            mixed.push_back(Legit(i));
+    }
+    size_t legit = mixed.size() - flood.size();
+
+    size_t accepted = 0;
+    double dropUs = Run(flood, Classified, accepted);
+    size_t floodAccepted = accepted;
+    double decodeDropUs = Run(flood, Decode, accepted);
+    printf("flood drop: classifier %.2f Mpps/core, decode %.2f Mpps/core\n", count / dropUs, count / decodeDropUs);
+    // decoding alone lets requests with a bogus mode through
+    printf("flood let through: classifier %zu, decode %zu of %u\n", floodAccepted, accepted, count);
+    CHECK(floodAccepted <= accepted);
+
+    double mixedUs = Run(mixed, Classified, accepted);
+    CHECK(accepted == legit + floodAccepted);
+    double decodeMixedUs = Run(mixed, Decode, accepted);
+    CHECK(accepted >= legit);
+    printf("under flood: %.2f Mpps/core of served traffic with the classifier, %.2f Mpps/core without\n",
+           legit / mixedUs, legit / decodeMixedUs);
+
+
+    RrqFlood();
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "msg/TFTPMessages.h"
+#include "msg/TFTPClassifier.h"
+#include "TestCheck.h"
+
+#include <vector>
+
+using namespace oms::msg;
+
+static std::vector<uint8_t> Encode(const TFTPMessage &msg)
+{
+    std::vector<uint8_t> buf(1024);
+    int32_t len = msg.Encode(&buf[0], buf.size());
+    CHECK(len > 0);
+    buf.resize(len);
+    return buf;
+}
+
+static tftp_class_e Classify(const std::vector<uint8_t> &buf, bool knownTid)
+{
+    return TFTPClassifier::Classify(buf.empty() ? NULL : &buf[0], buf.size(), knownTid);
+}
+
+static void TestWellFormed()
+{
+    TFTPRReqMessage rrq("pxelinux.0", TFTP_MODE_OCTET);
+    std::vector<uint8_t> buf = Encode(rrq);
+    CHECK(Classify(buf, false) == TFTP_CLASS_REQUEST);
+    CHECK(Classify(buf, true) == TFTP_CLASS_REQUEST);
+
+    TFTPRReqMessage decoded;
+    CHECK(decoded.Decode(&buf[0], buf.size()) == (int32_t)buf.size());
+    CHECK(!strcmp(decoded.FileName(), "pxelinux.0"));
+    CHECK(decoded.TransferMode() == TFTP_MODE_OCTET);
+
+    TFTPWReqMessage wrq("cfg/switch1", TFTP_MODE_NETASCII);
+    wrq.Opts().insert(TFTP_OPT_BLKSIZE, 1428u);
+    wrq.Opts().insert(TFTP_OPT_TSIZE, 0u);
+    CHECK(Classify(Encode(wrq), false) == TFTP_CLASS_REQUEST);
+
+    uint8_t payload[512] = {0};
+    TFTPDataMessage data(7, payload, sizeof(payload));
+    CHECK(Classify(Encode(data), true) == TFTP_CLASS_SESSION);
+    CHECK(Classify(Encode(data), false) == TFTP_CLASS_DROP_UNKNOWN_TID);
+
+    CHECK(Classify(Encode(TFTPAckMessage(7)), true) == TFTP_CLASS_SESSION);
+    CHECK(Classify(Encode(TFTPErrMessage(TFTP_ERR_DISK_FULL, "full")), true) == TFTP_CLASS_SESSION);
+    CHECK(Classify(Encode(TFTPErrMessage(TFTP_ERR_DISK_FULL)), true) == TFTP_CLASS_SESSION);
+
+    TFTPOAckMessage oack;
+    oack.Opts().insert(TFTP_OPT_BLKSIZE, 1428u);
+    CHECK(Classify(Encode(oack), true) == TFTP_CLASS_SESSION);
+    CHECK(Classify(Encode(oack), false) == TFTP_CLASS_DROP_UNKNOWN_TID);
+}
+
+static std::vector<uint8_t> Raw(const char *s, size_t len)
+{
+    return std::vector<uint8_t>(s, s + len);
+}
+
+static void TestMalformed()
+{
+    CHECK(Classify(std::vector<uint8_t>(), true) == TFTP_CLASS_DROP_SHORT);
+    CHECK(Classify(Raw("\0\1a", 3), true) == TFTP_CLASS_DROP_SHORT);
+
+    CHECK(Classify(Raw("\0\0a\0octet\0", 10), true) == TFTP_CLASS_DROP_OPCODE);
+    CHECK(Classify(Raw("\0\7a\0octet\0", 10), true) == TFTP_CLASS_DROP_OPCODE);
+    CHECK(Classify(Raw("\1\1a\0octet\0", 10), true) == TFTP_CLASS_DROP_OPCODE);
+
+    // requests: terminators, empty filename, mode, dangling option
+    CHECK(Classify(Raw("\0\1a\0octet\0", 10), false) == TFTP_CLASS_REQUEST);
+    CHECK(Classify(Raw("\0\1a\0octet", 9), false) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\1abcdefgh", 10), false) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\1\0octet\0", 9), false) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\2a\0binary\0", 11), false) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\1a\0OCTET\0", 10), false) == TFTP_CLASS_REQUEST);
+    CHECK(Classify(Raw("\0\1a\0octet\0tsize\0", 16), false) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\1a\0octet\0tsize\0" "0\0", 18), false) == TFTP_CLASS_REQUEST);
+
+    CHECK(Classify(Raw("\0\4\0\1\0", 5), true) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\5\0\1", 4), true) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\5\0\1x", 5), true) == TFTP_CLASS_DROP_MALFORMED);
+    CHECK(Classify(Raw("\0\6blksize\0", 10), true) == TFTP_CLASS_DROP_MALFORMED);
+
+    std::vector<uint8_t> jumbo(4 + TFTPClassifier::MAX_BLKSIZE + 1, 0);
+    jumbo[1] = TFTP_OPCODE_DATA;
+    CHECK(Classify(jumbo, true) == TFTP_CLASS_DROP_MALFORMED);
+    jumbo.pop_back();
+    CHECK(Classify(jumbo, true) == TFTP_CLASS_SESSION);
+}
+
+// whatever the bytes, the classifier never reads past len
+static void TestFuzz()
+{
+    uint32_t seed = 5;
+    for (int i = 0; i < 200000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t len = (seed >> 16) % 24;
+        std::vector<uint8_t> buf(len);
+        for (size_t j = 0; j < len; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint8_t b = seed >> 24;
+            buf[j] = j < 2 ? b % 8 : (b & 1 ? 0 : 'a' + b % 26);
+        }
+        tftp_class_e c = Classify(buf, seed & 1);
+        if (c == TFTP_CLASS_REQUEST)
+        {
+            TFTPRReqMessage req;
+            CHECK(req.Decode(&buf[0], buf.size()) == (int32_t)buf.size());
+        }
+    }
+}
+
+int main()
+{
+    TestWellFormed();
+    TestMalformed();
+    TestFuzz();
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "compress/TFTPCompress.h"
+#include "TestCheck.h"
+
+#include <chrono>
+
+using namespace oms::compress;
+
+// A boot image stand-in: mostly text and code like runs with a random
+// block now and then for the parts that are already compressed.
+static std::string MakeImage(uint32_t len)
+{
+    static const char *words[] = {"console=", "ttyS0", "root=/dev/nfs ", "initrd", "\x48\x89\xe5",
+                                  "\x55\x48\x8b", "\x00\x00\x00\x00", "module_init", "kernel/", "ip=dhcp "};
+    std::string s;
+    uint32_t seed = 7;
+    while (s.length() < len)
+    {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 8)
+        {
+            for (int i = 0; i < 64; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                const char *w = words[(seed >> 16) % 10];
+                s.append(w, (seed >> 16) % 10 == 6 ? 4 : strlen(w));
+            }
+        }
+        else
+        {
+            for (int i = 0; i < 512; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                s += (char)(seed >> 24);
+            }
+        }
+    }
+    s.resize(len);
+    return s;
+}
+
+static double ElapsedUs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Cost
+{
+    uint64_t size;
+    double buildUs;
+    double inflateUs;
+};
+
+// best of a few runs for the server side build and the client side
+// decompression, which runs as DATA arrives
+static Cost Measure(const ICompressor &codec, const std::string &raw, uint16_t blkSize)
+{
+    Cost c = {0, 1e18, 1e18};
+    for (int run = 0; run < 3; run++)
+    {
+        TFTPCompressedImage image;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CHECK(image.Build(codec, (const uint8_t *)raw.data(), raw.length(), blkSize, 64 * 1024) == 0);
+        double us = ElapsedUs(start);
+        if (us < c.buildUs)
+            c.buildUs = us;
+        c.size = image.Size();
+
+        TFTPDecompressStream stream(codec, blkSize);
+        start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < image.BlockCount(); i++)
+        {
+            const uint8_t *blk = NULL;
+            int32_t n = image.Block(i, &blk);
+            CHECK(stream.Write(blk, n) == n);
+        }
+        us = ElapsedUs(start);
+        if (us < c.inflateUs)
+            c.inflateUs = us;
+        CHECK(stream.Complete() && stream.Output() == raw);
+    }
+    return c;
+}
+
+int main()
+{
+    const uint16_t blkSize = 1428;
+    std::string raw = MakeImage(4 * 1024 * 1024);
+    const double links[] = {10, 100, 1000, 10000};
+
+    const int levels[] = {1, 6, 9};
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++)
+    {
+        ZlibCompressor zlib(levels[l]);
+        Cost c = Measure(zlib, raw, blkSize);
+        printf("zlib -%d: ratio %.3f, build %.1f MB/s, inflate %.1f MB/s\n", levels[l],
+               (double)c.size / raw.length(), raw.length() / c.buildUs, raw.length() / c.inflateUs);
+        CHECK(c.size < raw.length());
+
+        // Transfer times in ms. A cached image costs the wire time of the
+        // compressed bytes or the client's inflate, whichever is slower; the
+        // first request also waits for the build.
+        for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+        {
+            double bytesPerUs = links[i] / 8;
+            double plain = raw.length() / bytesPerUs;
+            double wire = c.size / bytesPerUs;
+            double cached = wire > c.inflateUs ? wire : c.inflateUs;
+            printf("  %6.0f Mbit/s: plain %8.1f ms, cached %8.1f ms, first %8.1f ms%s\n", links[i],
+                   plain / 1000, cached / 1000, (cached + c.buildUs) / 1000, cached < plain ? "" : "  (no gain)");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "msg/TFTPMessages.h"
+#include "compress/TFTPCompress.h"
+#include "TestCheck.h"
+
+using namespace oms::msg;
+using namespace oms::compress;
+
+static std::string MakeFile(uint32_t len)
+{
+    std::string s;
+    uint32_t seed = 1;
+    while (s.length() < len)
+    {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 16)
+            s += "console=ttyS0,115200 root=/dev/nfs ";
+        else
+            s += (char)(seed >> 24);
+    }
+    s.resize(len);
+    return s;
+}
+
+static void TestNegotiate()
+{
+    ZlibCompressor zlib;
+    TFTPCompressors codecs;
+    codecs.Register(&zlib);
+
+    TFTPOpts req, oack;
+    req.insert(TFTP_OPT_COMPRESS, "lz4,ZLIB");
+    CHECK(codecs.Negotiate(req, oack) == &zlib);
+    CHECK(!strcmp(oack.find(TFTP_OPT_COMPRESS)->Value(), "zlib"));
+
+    TFTPOpts req2, oack2;
+    req2.insert(TFTP_OPT_COMPRESS, "lz4,,zstd");
+    CHECK(codecs.Negotiate(req2, oack2) == NULL);
+    CHECK(!oack2.contains(TFTP_OPT_COMPRESS));
+}
+
+static void TestTransfer(uint32_t fileLen, uint16_t blkSize, uint32_t chunkSize)
+{
+    ZlibCompressor zlib;
+    std::string file = MakeFile(fileLen);
+
+    TFTPCompressedImage image;
+    CHECK(image.Build(zlib, (const uint8_t *)file.data(), file.length(), blkSize, chunkSize) == 0);
+    CHECK(image.RawSize() == fileLen);
+    if (fileLen > 4096 && chunkSize >= blkSize)
+        CHECK(image.Size() < fileLen);
+
+    TFTPOAckMessage oack;
+    TFTPOpt tsize(TFTP_OPT_TSIZE, "");
+    tsize.SetValue((uint64_t)image.Size());
+    oack.Opts().insert(tsize);
+    CHECK(oack.Opts().find(TFTP_OPT_TSIZE)->UInt64Value() == image.Size());
+
+    TFTPDecompressStream stream(zlib, blkSize);
+    std::vector<uint8_t> wire(blkSize + 4);
+    for (uint64_t i = 0; i < image.BlockCount(); i++)
+    {
+        const uint8_t *blk = NULL;
+        int32_t n = image.Block(i, &blk);
+        CHECK(n >= 0);
+        CHECK(i + 1 == image.BlockCount() ? n < blkSize : n == blkSize);
+
+        TFTPDataMessage out((i + 1) & 0xFFFF, (uint8_t *)blk, n);
+        int32_t len = out.Encode(&wire[0], wire.size());
+        CHECK(len == n + 4);
+
+        TFTPDataMessage in;
+        CHECK(in.Decode(&wire[0], len) == len);
+        CHECK(in.BlockDataLength() == n);
+        CHECK(stream.Write(in.BlockData(), in.BlockDataLength()) == n);
+    }
+    CHECK(stream.Complete());
+    CHECK(stream.Output() == file);
+}
+
+// a receiver writing to disk as chunks complete holds one chunk at most
+static void TestTake()
+{
+    ZlibCompressor zlib;
+    std::string file = MakeFile(500 * 1024 + 3);
+    TFTPCompressedImage image;
+    CHECK(image.Build(zlib, (const uint8_t *)file.data(), file.length(), 1428, 16 * 1024) == 0);
+
+    TFTPDecompressStream stream(zlib, 1428);
+    std::string got, part;
+    for (uint64_t i = 0; i < image.BlockCount(); i++)
+    {
+        const uint8_t *blk = NULL;
+        int32_t n = image.Block(i, &blk);
+        CHECK(stream.Write(blk, n) == n);
+        CHECK(stream.Output().length() <= 16 * 1024);
+        stream.Take(part);
+        CHECK(stream.Output().empty());
+        got += part;
+    }
+    CHECK(stream.Complete() && got == file);
+}
+
+static struct stat MakeStat(uint64_t size, time_t sec, long nsec, ino_t ino)
+{
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_size = size;
+    st.st_ino = ino;
+    st.st_mtim.tv_sec = sec;
+    st.st_mtim.tv_nsec = nsec;
+    st.st_ctim = st.st_mtim;
+    return st;
+}
+
+static void TestCache()
+{
+    ZlibCompressor zlib;
+    std::string file = MakeFile(20000);
+    TFTPCompressCache cache(16 * 1024);
+    struct stat st = MakeStat(file.length(), 1, 0, 7);
+
+    TFTPCompressCache::image_ptr a = cache.Get("/a", zlib, 512, 8192, st);
+    CHECK(!a);
+
+    TFTPCompressedImage *image = new TFTPCompressedImage;
+    CHECK(image->Build(zlib, (const uint8_t *)file.data(), file.length(), 512, 8192) == 0);
+    a.reset(image);
+    cache.Put("/a", zlib, 512, 8192, st, a);
+    CHECK(cache.Get("/a", zlib, 512, 8192, st) == a);
+    CHECK(!cache.Get("/a", zlib, 1024, 8192, st));
+
+    // a newer mtime drops the stale image
+    CHECK(!cache.Get("/a", zlib, 512, 8192, MakeStat(file.length(), 2, 0, 7)));
+    CHECK(cache.Count() == 0 && cache.Bytes() == 0);
+
+    // so does a same size rewrite within the same second, and a file
+    // renamed over the path
+    cache.Put("/a", zlib, 512, 8192, st, a);
+    CHECK(!cache.Get("/a", zlib, 512, 8192, MakeStat(file.length(), 1, 500, 7)));
+    cache.Put("/a", zlib, 512, 8192, st, a);
+    CHECK(!cache.Get("/a", zlib, 512, 8192, MakeStat(file.length(), 1, 0, 8)));
+    CHECK(cache.Count() == 0);
+
+    for (int i = 0; i < 64; i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/f%d", i);
+        cache.Put(path, zlib, 512, 8192, st, a);
+        CHECK(cache.Bytes() <= 16 * 1024);
+    }
+    CHECK(cache.Get("/f63", zlib, 512, 8192, st) == a);
+    CHECK(!cache.Get("/f0", zlib, 512, 8192, st));
+}
+
+static void TestCorrupt()
+{
+    ZlibCompressor zlib;
+    std::string file = MakeFile(10000);
+    TFTPCompressedImage image;
+    CHECK(image.Build(zlib, (const uint8_t *)file.data(), file.length(), 512, 4096) == 0);
+
+    const uint8_t *blk = NULL;
+    int32_t n = image.Block(0, &blk);
+    std::vector<uint8_t> bad(blk, blk + n);
+    bad[20] ^= 0xFF;
+
+    TFTPDecompressStream stream(zlib, 512);
+    CHECK(stream.Write(&bad[0], bad.size()) < 0);
+}
+
+int main()
+{
+    TestNegotiate();
+    TestTransfer(0, 512, 8192);
+    TestTransfer(1, 512, 8192);
+    TestTransfer(512 * 40, 512, 512 * 8);
+    TestTransfer(300 * 1024 + 17, 1428, 64 * 1024);
+    TestTransfer(200 * 1024, 8192, 128 * 1024);
+    TestTransfer(3000, 8192, 1000);
+    TestTake();
+    TestCache();
+    TestCorrupt();
+    return 0;
+}
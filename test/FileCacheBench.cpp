@@ -0,0 +1,178 @@
+#include "file/TFTPFileCache.h"
+#include "TestCheck.h"
+
+#include <poll.h>
+#include <chrono>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace oms::file;
+
+// A PXE tree: a few boot images everyone asks for and a config file per
+// client MAC a few directories down.
+static const uint32_t FILES = 256;
+static const uint32_t REQUESTS = 20000;
+
+static std::string g_root;
+
+static std::string Name(uint32_t i)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "boot/pxelinux.cfg/01-52-54-00-%02x-%02x-%02x", (i >> 16) & 0xFF,
+             (i >> 8) & 0xFF, i & 0xFF);
+    return name;
+}
+
+static double ElapsedUs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// what a server without the cache does per RRQ before the first read
+static bool Uncached(const std::string &name, uint8_t *buf)
+{
+    std::string full = g_root + "/" + name;
+    int fd = open(full.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    char resolved[PATH_MAX];
+    bool ok = !fstat(fd, &st) && S_ISREG(st.st_mode) && realpath(full.c_str(), resolved) &&
+              !strncmp(resolved, g_root.c_str(), g_root.length()) && pread(fd, buf, 512, 0) > 0;
+    close(fd);
+    return ok;
+}
+
+static bool Cached(TFTPFileCache &cache, const std::string &name, uint8_t *buf)
+{
+    TFTPFileCache::file_ptr file = cache.Acquire(name.c_str());
+    return file && pread(file->Fd(), buf, 512, 0) > 0;
+}
+
+static void Wait(IFileProvider &provider)
+{
+    struct pollfd pfd;
+    pfd.fd = provider.ReadyFd();
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 5000) == 1);
+    provider.ClearReady();
+}
+
+// What the event loop sees: open, the size for the OACK, then the first
+// DATA block, each retried when the provider's workers signal.
+static void FirstBlock(IFileProvider &provider, const std::string &path, uint8_t *buf)
+{
+    int32_t r = provider.Open(path.c_str());
+    CHECK(r > 0);
+    uint64_t size = 0;
+    int32_t ret;
+    while ((ret = provider.Stat(r, size)) == TFTP_FILE_PENDING)
+        Wait(provider);
+    CHECK(ret == 0 && size > 0);
+    while ((ret = provider.Read(r, 0, 512, buf)) == TFTP_FILE_PENDING)
+        Wait(provider);
+    CHECK(ret == 512);
+    provider.Close(r);
+}
+
+// time to the first block through ReadAheadFileProvider, straight on the
+// file system and through the cache
+static void ThroughProvider(const std::vector<std::string> &names, uint8_t *buf)
+{
+    const uint32_t requests = names.size() / 4;
+    double posix = 1e18, cached = 1e18;
+    for (int run = 0; run < 3; run++)
+    {
+        PosixFileBackend backend;
+        ReadAheadFileProvider provider(backend, 2, 64 * 1024);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < requests; i++)
+            FirstBlock(provider, g_root + "/" + names[i], buf);
+        double us = ElapsedUs(start) / requests;
+        posix = us < posix ? us : posix;
+
+        TFTPFileCache cache(g_root.c_str(), FILES);
+        CachedFileBackend cachedBackend(cache);
+        ReadAheadFileProvider cachedProvider(cachedBackend, 2, 64 * 1024);
+        for (uint32_t i = 0; i < FILES; i++)
+            FirstBlock(cachedProvider, Name(i), buf);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < requests; i++)
+            FirstBlock(cachedProvider, names[i], buf);
+        us = ElapsedUs(start) / requests;
+        cached = us < cached ? us : cached;
+        CHECK(cache.Misses() == FILES && cache.Hits() == requests);
+    }
+    printf("RRQ to first block through ReadAheadFileProvider:\n");
+    printf("  PosixFileBackend:    %6.2f us\n", posix);
+    printf("  CachedFileBackend:   %6.2f us (warm)\n", cached);
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/tftp_file_cache_bench_XXXXXX";
+    CHECK(mkdtemp(tmpl));
+    char resolved[PATH_MAX];
+    CHECK(realpath(tmpl, resolved));
+    g_root = resolved;
+    CHECK(mkdir((g_root + "/boot").c_str(), 0755) == 0);
+    CHECK(mkdir((g_root + "/boot/pxelinux.cfg").c_str(), 0755) == 0);
+
+    std::string data(2048, 'x');
+    for (uint32_t i = 0; i < FILES; i++)
+    {
+        FILE *fp = fopen((g_root + "/" + Name(i)).c_str(), "w");
+        CHECK(fp);
+        fwrite(data.data(), 1, data.length(), fp);
+        fclose(fp);
+    }
+
+    std::vector<std::string> names;
+    uint32_t seed = 5;
+    for (uint32_t i = 0; i < REQUESTS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        names.push_back(Name((seed >> 8) % FILES));
+    }
+
+    uint8_t buf[512];
+    double uncached = 1e18, cached = 1e18, miss = 1e18;
+    for (int run = 0; run < 3; run++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < REQUESTS; i++)
+            CHECK(Uncached(names[i], buf));
+        double us = ElapsedUs(start) / REQUESTS;
+        uncached = us < uncached ? us : uncached;
+
+        // a cold cache, every file once
+        TFTPFileCache cache(g_root.c_str(), FILES);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < FILES; i++)
+            CHECK(Cached(cache, Name(i), buf));
+        us = ElapsedUs(start) / FILES;
+        miss = us < miss ? us : miss;
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < REQUESTS; i++)
+            CHECK(Cached(cache, names[i], buf));
+        us = ElapsedUs(start) / REQUESTS;
+        cached = us < cached ? us : cached;
+        CHECK(cache.Misses() == FILES && cache.Hits() == REQUESTS);
+    }
+
+    printf("RRQ to first read on the calling thread, %u files:\n", FILES);
+    printf("  open+fstat+realpath: %6.2f us\n", uncached);
+    printf("  cache miss:          %6.2f us\n", miss);
+    printf("  cache hit:           %6.2f us\n", cached);
+    ThroughProvider(names, buf);
+
+    for (uint32_t i = 0; i < FILES; i++)
+        unlink((g_root + "/" + Name(i)).c_str());
+    rmdir((g_root + "/boot/pxelinux.cfg").c_str());
+    rmdir((g_root + "/boot").c_str());
+    rmdir(g_root.c_str());
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include "file/TFTPFileCache.h"
+#include "TestCheck.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace oms::file;
+using namespace oms::msg;
+
+static std::string g_root;
+static std::string g_out;
+
+static void WriteFile(const char *name, const char *data)
+{
+    std::string path = g_root + "/" + name;
+    FILE *fp = fopen(path.c_str(), "w");
+    CHECK(fp);
+    fputs(data, fp);
+    fclose(fp);
+}
+
+static void TestNormalize()
+{
+    std::string rel;
+    CHECK(TFTPFileCache::Normalize("a", rel) && rel == "a");
+    CHECK(TFTPFileCache::Normalize("/a", rel) && rel == "a");
+    CHECK(TFTPFileCache::Normalize("./x//y/", rel) && rel == "x/y");
+    CHECK(TFTPFileCache::Normalize("x/../a", rel) && rel == "a");
+    CHECK(!TFTPFileCache::Normalize("../etc/passwd", rel));
+    CHECK(!TFTPFileCache::Normalize("x/../../a", rel));
+    CHECK(!TFTPFileCache::Normalize("", rel));
+    CHECK(!TFTPFileCache::Normalize("/./", rel));
+}
+
+static void TestLookup()
+{
+    TFTPFileCache cache(g_root.c_str(), 8);
+    uint16_t err = 0;
+
+    TFTPFileCache::file_ptr a = cache.Acquire("a", &err);
+    CHECK(a && a->Size() == 5 && a->Fd() >= 0);
+    CHECK(cache.Acquire("/./a") == a);
+    CHECK(cache.Acquire("x/../a") == a);
+    CHECK(cache.Misses() == 1 && cache.Hits() == 2);
+
+    CHECK(!cache.Acquire("missing", &err) && err == TFTP_ERR_FILE_NOT_FOUND);
+    CHECK(!cache.Acquire("../a", &err) && err == TFTP_ERR_ACCESS_VIOLATION);
+    CHECK(!cache.Acquire("x", &err) && err == TFTP_ERR_ACCESS_VIOLATION);
+    CHECK(!cache.Acquire("out", &err) && err == TFTP_ERR_ACCESS_VIOLATION);
+    CHECK(!cache.Acquire("outdir/passwd", &err) && err == TFTP_ERR_ACCESS_VIOLATION);
+    CHECK(cache.Size() == 1);
+}
+
+static void TestInvalidate()
+{
+    TFTPFileCache cache(g_root.c_str(), 8);
+    CHECK(cache.NotifyFd() >= 0);
+
+    TFTPFileCache::file_ptr a = cache.Acquire("a");
+    CHECK(a && a->Size() == 5);
+    CHECK(cache.ProcessEvents() == 0);
+
+    // rewritten in place
+    WriteFile("a", "hello world");
+    CHECK(cache.ProcessEvents() == 1);
+    TFTPFileCache::file_ptr b = cache.Acquire("a");
+    CHECK(b && b != a && b->Size() == 11);
+    // the running transfer keeps its fd
+    char c;
+    CHECK(pread(a->Fd(), &c, 1, 0) == 1);
+
+    // replaced by rename, the old inode loses its link
+    WriteFile("a.new", "replaced");
+    CHECK(rename((g_root + "/a.new").c_str(), (g_root + "/a").c_str()) == 0);
+    CHECK(cache.ProcessEvents() == 1);
+    TFTPFileCache::file_ptr n = cache.Acquire("a");
+    CHECK(n && n->Size() == 8);
+    CHECK(b->Size() == 11);
+
+    cache.Invalidate("/a");
+    CHECK(cache.Size() == 0);
+    CHECK(cache.Acquire("a") != n);
+}
+
+static void TestBound()
+{
+    TFTPFileCache cache(g_root.c_str(), 2);
+    TFTPFileCache::file_ptr a = cache.Acquire("a");
+    TFTPFileCache::file_ptr b = cache.Acquire("b");
+    CHECK(cache.Acquire("a") == a);
+    TFTPFileCache::file_ptr c = cache.Acquire("c");
+    CHECK(cache.Size() == 2);
+    // b was least recently used
+    CHECK(cache.Acquire("a") == a);
+    CHECK(cache.Acquire("b") != b);
+    // evicted, still open for its holders
+    char ch;
+    CHECK(pread(b->Fd(), &ch, 1, 0) == 1 && ch == 'b');
+
+    // an evicted entry's watch is gone, a write to it costs nothing
+    WriteFile("c", "cc");
+    cache.ProcessEvents();
+    CHECK(cache.Size() == 2);
+}
+
+// a FIFO nobody writes to would block a plain open forever
+static void TestFifo()
+{
+    TFTPFileCache cache(g_root.c_str(), 8);
+    uint16_t err = 0;
+    CHECK(mkfifo((g_root + "/fifo").c_str(), 0644) == 0);
+    CHECK(!cache.Acquire("fifo", &err) && err == TFTP_ERR_ACCESS_VIOLATION);
+    CHECK(cache.Size() == 0);
+}
+
+// a root of "/" serves every absolute path, the prefix check must not
+// look for a second slash
+static void TestRootSlash()
+{
+    TFTPFileCache cache("/", 8);
+    uint16_t err = 0;
+    TFTPFileCache::file_ptr b = cache.Acquire((g_root + "/b").c_str(), &err);
+    CHECK(b && b->Size() == 1);
+    CHECK(cache.Acquire((g_root + "/out").c_str(), &err) == NULL && err == TFTP_ERR_ACCESS_VIOLATION);
+
+    TFTPFileCache slash((g_root + "//").c_str(), 8);
+    CHECK(slash.Acquire("b") && !slash.Acquire("outdir/passwd"));
+}
+
+static void Wait(IFileProvider &provider)
+{
+    struct pollfd pfd;
+    pfd.fd = provider.ReadyFd();
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 5000) == 1);
+    provider.ClearReady();
+}
+
+// the event loop reaches the cache through the provider, misses are
+// opened on its workers and a repeated open shares the cached fd
+static void TestBackend()
+{
+    TFTPFileCache cache(g_root.c_str(), 8);
+    CachedFileBackend backend(cache);
+    ReadAheadFileProvider provider(backend, 2);
+    WriteFile("d", "hello");
+
+    for (int round = 0; round < 2; round++)
+    {
+        int32_t r = provider.Open("/d");
+        CHECK(r > 0);
+        uint64_t size = 0;
+        int32_t ret;
+        while ((ret = provider.Stat(r, size)) == TFTP_FILE_PENDING)
+            Wait(provider);
+        CHECK(ret == 0 && size == 5);
+
+        uint8_t buf[512];
+        while ((ret = provider.Read(r, 0, 512, buf)) == TFTP_FILE_PENDING)
+            Wait(provider);
+        CHECK(ret == 5 && !memcmp(buf, "hello", 5));
+        provider.Close(r);
+    }
+    CHECK(cache.Misses() == 1 && cache.Hits() == 1);
+
+    int32_t r = provider.Open("../d");
+    uint64_t size = 0;
+    int32_t ret;
+    while ((ret = provider.Stat(r, size)) == TFTP_FILE_PENDING)
+        Wait(provider);
+    CHECK(ret == TFTP_FILE_ERROR);
+    provider.Close(r);
+}
+
+// A release is rolled out by swapping the directory above the files.
+// Only the file inodes are watched, no event arrives, the hit itself has
+// to notice.
+static void TestDirectorySwap()
+{
+    TFTPFileCache cache(g_root.c_str(), 8);
+    CHECK(mkdir((g_root + "/images").c_str(), 0755) == 0);
+    CHECK(mkdir((g_root + "/images.new").c_str(), 0755) == 0);
+    WriteFile("images/f", "old");
+    WriteFile("images.new/f", "new image");
+
+    TFTPFileCache::file_ptr old = cache.Acquire("images/f");
+    CHECK(old && old->Size() == 3);
+    CHECK(rename((g_root + "/images").c_str(), (g_root + "/images.old").c_str()) == 0);
+    CHECK(rename((g_root + "/images.new").c_str(), (g_root + "/images").c_str()) == 0);
+    cache.ProcessEvents();
+    TFTPFileCache::file_ptr cur = cache.Acquire("images/f");
+    CHECK(cur && cur->Size() == 9);
+    CHECK(cache.Acquire("images/f") == cur);
+    CHECK(cache.Hits() == 1 && cache.Size() == 1);
+
+    // moved out of the root and linked back in, no longer served
+    uint16_t err = 0;
+    CHECK(rename((g_root + "/images").c_str(), (g_out + "/images").c_str()) == 0);
+    CHECK(!cache.Acquire("images/f", &err) && err == TFTP_ERR_FILE_NOT_FOUND);
+    CHECK(symlink((g_out + "/images").c_str(), (g_root + "/images").c_str()) == 0);
+    CHECK(!cache.Acquire("images/f", &err) && err == TFTP_ERR_ACCESS_VIOLATION);
+    CHECK(cache.Size() == 0);
+
+    remove((g_root + "/images").c_str());
+    remove((g_root + "/images.old/f").c_str());
+    rmdir((g_root + "/images.old").c_str());
+    remove((g_out + "/images/f").c_str());
+    rmdir((g_out + "/images").c_str());
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/tftp_file_cache_XXXXXX";
+    char out[] = "/tmp/tftp_file_cache_out_XXXXXX";
+    CHECK(mkdtemp(tmpl) && mkdtemp(out));
+    g_root = tmpl;
+    g_out = out;
+
+    WriteFile("a", "hello");
+    WriteFile("b", "b");
+    WriteFile("c", "c");
+    CHECK(mkdir((g_root + "/x").c_str(), 0755) == 0);
+    std::string passwd = std::string(out) + "/passwd";
+    FILE *fp = fopen(passwd.c_str(), "w");
+    CHECK(fp);
+    fclose(fp);
+    CHECK(symlink(passwd.c_str(), (g_root + "/out").c_str()) == 0);
+    CHECK(symlink(out, (g_root + "/outdir").c_str()) == 0);
+
+    TestNormalize();
+    TestLookup();
+    TestInvalidate();
+    TestBound();
+    TestFifo();
+    TestRootSlash();
+    TestBackend();
+    TestDirectorySwap();
+
+    const char *names[] = {"a", "b", "c", "d", "fifo", "out", "outdir", "x"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        remove((g_root + "/" + names[i]).c_str());
+    remove(passwd.c_str());
+    rmdir(out);
+    rmdir(tmpl);
+    return 0;
+}
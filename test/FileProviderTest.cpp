@@ -0,0 +1,255 @@
+#include "file/TFTPFileProvider.h"
+#include "TestCheck.h"
+
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+
+using namespace oms::file;
+
+// a backend on slow storage, every read takes a while
+class SlowBackend : public IFileBackend
+{
+    PosixFileBackend m_posix;
+    uint32_t m_delayMs;
+
+public:
+    std::atomic<uint32_t> reads;
+
+    SlowBackend(uint32_t delayMs) : m_delayMs(delayMs), reads(0)
+    {
+    }
+    void *Open(const char *path, uint64_t &size)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_delayMs));
+        return m_posix.Open(path, size);
+    }
+    int64_t ReadAt(void *file, uint64_t off, uint8_t *buf, uint32_t len)
+    {
+        reads++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_delayMs));
+        return m_posix.ReadAt(file, off, buf, len);
+    }
+    void Close(void *file)
+    {
+        m_posix.Close(file);
+    }
+};
+
+static std::string MakeFile(uint64_t len)
+{
+    std::string s(len, 0);
+    uint32_t seed = 3;
+    for (uint64_t i = 0; i < len; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        s[i] = seed >> 24;
+    }
+    return s;
+}
+
+static std::string TempPath(const std::string &content)
+{
+    char path[] = "/tmp/tftp_provider_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    CHECK(write(fd, content.data(), content.length()) == (ssize_t)content.length());
+    close(fd);
+    return path;
+}
+
+static int64_t NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static void Wait(IFileProvider &provider)
+{
+    if (provider.ReadyFd() < 0)
+        return;
+    struct pollfd pfd;
+    pfd.fd = provider.ReadyFd();
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 5000) == 1);
+    provider.ClearReady();
+}
+
+static void TestMemory()
+{
+    MemoryFileProvider provider;
+    std::string file = MakeFile(1000);
+    provider.Insert("/boot/initrd", file);
+    CHECK(provider.Open("/missing") == TFTP_FILE_ERROR);
+
+    int32_t r = provider.Open("/boot/initrd");
+    CHECK(r > 0);
+    uint64_t size = 0;
+    CHECK(provider.Stat(r, size) == 0 && size == 1000);
+
+    uint8_t buf[512];
+    CHECK(provider.Read(r, 0, 512, buf) == 512 && !memcmp(buf, file.data(), 512));
+    CHECK(provider.Read(r, 1, 512, buf) == 488 && !memcmp(buf, file.data() + 512, 488));
+    CHECK(provider.Read(r, 2, 512, buf) == TFTP_FILE_ERROR);
+
+    // readers keep their snapshot
+    provider.Remove("/boot/initrd");
+    CHECK(provider.Read(r, 0, 512, buf) == 512);
+    provider.Close(r);
+    CHECK(provider.Read(r, 0, 512, buf) == TFTP_FILE_ERROR);
+}
+
+// Two readers, one twice as fast, pull the whole file through the event loop
+// style retry cycle. Nothing on the calling thread may wait for storage.
+static void TestReadAhead()
+{
+    std::string file = MakeFile(3 * 1024 * 1024 + 77);
+    std::string path = TempPath(file);
+
+    SlowBackend backend(20);
+    ReadAheadFileProvider provider(backend, 4, 64 * 1024, 4, 16);
+
+    const uint16_t blkSize = 1428;
+    int32_t readers[2];
+    std::string got[2];
+    uint64_t next[2] = {0, 0};
+    bool done[2] = {false, false};
+    for (int i = 0; i < 2; i++)
+    {
+        readers[i] = provider.Open(path.c_str());
+        CHECK(readers[i] > 0);
+    }
+
+    uint64_t size = 0;
+    int64_t start = NowUs();
+    CHECK(provider.Stat(readers[0], size) == TFTP_FILE_PENDING);
+    CHECK(NowUs() - start < 10000);
+    while (provider.Stat(readers[0], size) == TFTP_FILE_PENDING)
+        Wait(provider);
+    CHECK(size == file.length());
+
+    int64_t slowest = 0;
+    std::vector<uint8_t> buf(blkSize);
+    while (!done[0] || !done[1])
+    {
+        bool pending = false;
+        for (int i = 0; i < 2; i++)
+        {
+            // reader 1 moves at half the pace of reader 0
+            for (int n = 0; n < (i ? 1 : 2) && !done[i]; n++)
+            {
+                int64_t t = NowUs();
+                int32_t ret = provider.Read(readers[i], next[i], blkSize, &buf[0]);
+                if (NowUs() - t > slowest)
+                    slowest = NowUs() - t;
+
+                if (ret == TFTP_FILE_PENDING)
+                {
+                    pending = true;
+                    break;
+                }
+                CHECK(ret >= 0);
+                got[i].append((const char *)&buf[0], ret);
+                next[i]++;
+                done[i] = ret < blkSize;
+            }
+        }
+        CHECK(provider.Cached(path.c_str()) <= 2 * (4 + 2) + 16);
+        if (pending)
+            Wait(provider);
+    }
+
+    CHECK(got[0] == file && got[1] == file);
+    // the slow reader reloads what did not fit between the two
+    CHECK(backend.reads <= 2 * (file.length() / (64 * 1024) + 1));
+    CHECK(slowest < 10000);
+
+    provider.Close(readers[0]);
+    provider.Close(readers[1]);
+    unlink(path.c_str());
+}
+
+// Many clients on one image, started at staggered times so they spread
+// over the whole file. Readers keep their own chunks alive and every read
+// eventually completes.
+static void TestManyReaders()
+{
+    std::string file = MakeFile(1024 * 1024 + 5);
+    std::string path = TempPath(file);
+
+    PosixFileBackend backend;
+    ReadAheadFileProvider provider(backend, 2, 16 * 1024, 2, 8);
+
+    const uint32_t count = 300;
+    const uint16_t blkSize = 1024;
+    std::vector<int32_t> readers(count);
+    std::vector<uint64_t> next(count, 0);
+    std::vector<std::string> got(count);
+    for (uint32_t i = 0; i < count; i++)
+        readers[i] = provider.Open(path.c_str());
+
+    uint64_t size = 0;
+    while (provider.Stat(readers[0], size) == TFTP_FILE_PENDING)
+        Wait(provider);
+
+    std::vector<uint8_t> buf(blkSize);
+    uint32_t done = 0;
+    for (uint32_t round = 0; done < count; round++)
+    {
+        bool pending = false;
+        for (uint32_t i = 0; i < count && i <= round * 4; i++)
+        {
+            if (next[i] == UINT64_MAX)
+                continue;
+            int32_t ret = provider.Read(readers[i], next[i], blkSize, &buf[0]);
+            if (ret == TFTP_FILE_PENDING)
+            {
+                pending = true;
+                continue;
+            }
+            CHECK(ret >= 0);
+            got[i].append((const char *)&buf[0], ret);
+            next[i]++;
+            if (ret < blkSize)
+            {
+                next[i] = UINT64_MAX;
+                provider.Close(readers[i]);
+                done++;
+            }
+        }
+        if (pending)
+            Wait(provider);
+    }
+    for (uint32_t i = 0; i < count; i++)
+        CHECK(got[i] == file);
+    CHECK(provider.Cached(path.c_str()) == 0);
+    unlink(path.c_str());
+}
+
+static void TestMissing()
+{
+    PosixFileBackend backend;
+    ReadAheadFileProvider provider(backend, 1);
+    int32_t r = provider.Open("/nonexistent/tftp/file");
+    CHECK(r > 0);
+
+    uint64_t size = 0;
+    int32_t ret;
+    while ((ret = provider.Stat(r, size)) == TFTP_FILE_PENDING)
+        Wait(provider);
+    CHECK(ret == TFTP_FILE_ERROR);
+
+    uint8_t buf[512];
+    CHECK(provider.Read(r, 0, 512, buf) == TFTP_FILE_ERROR);
+    provider.Close(r);
+}
+
+int main()
+{
+    TestMemory();
+    TestReadAhead();
+    TestManyReaders();
+    TestMissing();
+    return 0;
+}
@@ -1,12 +1,99 @@
 #include "msg/TFTPMessages.h"
+#include "TestCheck.h"
+
+using namespace oms::msg;
+
+static void TestData()
+{
+    const uint8_t payload[] = {1, 2, 3, 4, 5};
+    TFTPDataMessage data;
+    data.SetBlockNumber(7);
+    data.SetBlockData(payload, sizeof(payload));
+    CHECK(data.BlockDataLength() == sizeof(payload));
+    CHECK(!memcmp(data.BlockData(), payload, sizeof(payload)));
+
+    uint8_t buf[64];
+    int32_t len = data.Encode(buf, sizeof(buf));
+    CHECK(len == 4 + (int32_t)sizeof(payload));
+
+    TFTPDataMessage decoded;
+    CHECK(decoded.Decode(buf, len) == len);
+    CHECK(decoded.BlockNumber() == 7);
+    CHECK(decoded.BlockDataLength() == sizeof(payload));
+    CHECK(!memcmp(decoded.BlockData(), payload, sizeof(payload)));
+
+    // the final empty block
+    CHECK(decoded.Decode(buf, 4) == 4);
+    CHECK(!decoded.BlockData() && !decoded.BlockDataLength());
+}
+
+static void TestErr()
+{
+    TFTPErrMessage err(TFTP_ERR_FILE_NOT_FOUND);
+    CHECK(!strcmp(err.ErrorMsg(), ""));
+    err.SetErrorMsg(NULL);
+    CHECK(!strcmp(err.ErrorMsg(), ""));
+
+    uint8_t buf[64];
+    int32_t len = err.Encode(buf, sizeof(buf));
+    CHECK(len == 5);
+
+    TFTPErrMessage decoded(0, "x");
+    CHECK(decoded.Decode(buf, len) == len);
+    CHECK(decoded.ErrorCode() == TFTP_ERR_FILE_NOT_FOUND && !strcmp(decoded.ErrorMsg(), ""));
+}
+
+static void TestOption()
+{
+    TFTPOpt opt(TFTP_OPT_TSIZE, "");
+    opt.SetValue((uint64_t)18446744073709551615ULL);
+    CHECK(!strcmp(opt.Value(), "18446744073709551615"));
+    opt.SetValue((uint64_t)4294967296ULL);
+    CHECK(opt.UInt64Value() == 4294967296ULL);
+}
+
+static void TestRequest()
+{
+    uint8_t buf[512];
+
+    // no options at all, the plain RFC 1350 form
+    TFTPRReqMessage rrq("boot/pxelinux.0", TFTP_MODE_OCTET);
+    int32_t len = rrq.Encode(buf, sizeof(buf));
+    CHECK(len == 2 + 16 + 6);
+
+    TFTPRReqMessage decoded;
+    decoded.SetTransferMode(TFTP_MODE_INVALID);
+    CHECK(decoded.Decode(buf, len) == len);
+    CHECK(!strcmp(decoded.FileName(), "boot/pxelinux.0"));
+    CHECK(decoded.TransferMode() == TFTP_MODE_OCTET);
+    CHECK(decoded.Opts().empty());
+
+    TFTPWReqMessage wrq("log.txt", TFTP_MODE_NETASCII);
+    wrq.Opts().insert(TFTP_OPT_BLKSIZE, 1428u);
+    wrq.Opts().insert(TFTP_OPT_TSIZE, 0u);
+    len = wrq.Encode(buf, sizeof(buf));
+    CHECK(len > 0);
+
+    TFTPWReqMessage wdecoded;
+    CHECK(wdecoded.Decode(buf, len) == len);
+    CHECK(wdecoded.TransferMode() == TFTP_MODE_NETASCII);
+    CHECK(wdecoded.Opts().find(TFTP_OPT_BLKSIZE)->UInt32Value() == 1428);
+    CHECK(wdecoded.Opts().contains(TFTP_OPT_TSIZE));
+
+    // mode names are case insensitive
+    const uint8_t mail[] = {0, 1, 'a', 0, 'M', 'a', 'I', 'l', 0};
+    CHECK(decoded.Decode(mail, sizeof(mail)) == (int32_t)sizeof(mail));
+    CHECK(decoded.TransferMode() == TFTP_MODE_MAIL);
+    const uint8_t bad[] = {0, 1, 'a', 0, 'b', 'i', 'n', 0};
+    CHECK(decoded.Decode(bad, sizeof(bad)) == (int32_t)sizeof(bad));
+    CHECK(decoded.TransferMode() == TFTP_MODE_INVALID);
+}
 
 int main()
 {
-    oms::msg::TFTPRReqMessage rReq;
-    oms::msg::TFTPWReqMessage wReq;
-    oms::msg::TFTPDataMessage data;
-    oms::msg::TFTPAckMessage ack;
-    oms::msg::TFTPErrMessage err;
-    oms::msg::TFTPOAckMessage oack;
+    TestData();
+    TestErr();
+    TestOption();
+    TestRequest();
     return 0;
-}
\ No newline at end of file
+}
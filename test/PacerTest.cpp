@@ -0,0 +1,265 @@
+#include "xfer/TFTPPacer.h"
+#include "TestCheck.h"
+
+#include <deque>
+
+using namespace oms::xfer;
+
+static void TestSpacing()
+{
+    // 1.5 MB/s, one 1500 byte packet per millisecond
+    TFTPPacer pacer(1500000, 1500);
+    uint64_t now = 1000000;
+    CHECK(pacer.Delay(1500, now) == 0);
+    pacer.OnSend(1500, now);
+    uint64_t d = pacer.Delay(1500, now);
+    CHECK(d >= 999 && d <= 1000);
+    CHECK(pacer.Delay(1500, now + d) == 0);
+
+    // a packet larger than the quantum is not stuck forever
+    TFTPPacer big(1500000, 1500);
+    CHECK(big.Delay(9000, now) == 0);
+    big.OnSend(9000, now);
+    CHECK(big.Delay(9000, now) > 0);
+    CHECK(big.Delay(9000, now + 6000) == 0);
+}
+
+static void TestAckClock()
+{
+    TFTPPacer pacer(100000, 1500);
+    CHECK(pacer.Startup() && pacer.Rate() == 100000);
+
+    // 10 MB/s bottleneck, 100 us per 1000 byte packet, 2 ms base RTT: a
+    // lone packet is acked after 2.1 ms, ten back to back after 3 ms
+    uint64_t now = 0;
+    pacer.OnSend(1000, now);
+    now += 2100;
+    pacer.OnAck(1000, now);
+    CHECK(pacer.MinRtt() == 2100 && pacer.BottleneckRate() == 0);
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 10; i++)
+            pacer.OnSend(1000, now);
+        now += 3000;
+        pacer.OnAck(10000, now);
+    }
+    CHECK(pacer.MinRtt() == 2100);
+    CHECK(pacer.BottleneckRate() == 10000000);
+    CHECK(!pacer.Startup());
+    CHECK(pacer.Rate() >= 7500000 && pacer.Rate() <= 12500000);
+
+    pacer.OnTimeout();
+    CHECK(pacer.Rate() <= 6250000 && pacer.BottleneckRate() == pacer.Rate());
+
+    TFTPPacer capped(100000, 1500, 2000000);
+    capped.OnSend(1000, now);
+    now += 2100;
+    capped.OnAck(1000, now);
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 10; i++)
+            capped.OnSend(1000, now);
+        now += 3000;
+        capped.OnAck(10000, now);
+    }
+    CHECK(capped.Rate() == 2000000);
+}
+
+static void TestCap()
+{
+    // two sessions that would each go at 10 MB/s under a 1 MB/s cap
+    TFTPBandwidthCap cap(1000000, 3000);
+    TFTPPacer a(10000000, 1500), b(10000000, 1500);
+    TFTPPacer *pacers[2] = {&a, &b};
+    uint64_t sent[2] = {0, 0};
+    int turn = 0;
+
+    for (uint64_t now = 1000000; now < 2000000; now += 10)
+    {
+        // the loop takes turns, or the first session gets every refill
+        for (int j = 0; j < 2; j++)
+        {
+            int i = (turn + j) % 2;
+            if (pacers[i]->Delay(1500, now) || cap.Delay(1500, now))
+                continue;
+            pacers[i]->OnSend(1500, now);
+            cap.OnSend(1500);
+            sent[i] += 1500;
+            turn = i + 1;
+        }
+    }
+    uint64_t total = sent[0] + sent[1];
+    CHECK(total >= 990000 && total <= 1000000 + 3000);
+    CHECK(sent[0] > total / 3 && sent[1] > total / 3);
+}
+
+// User space bottleneck: a 1 Gbps server NIC feeding a 100 Mbps link with
+// a 16 KB drop tail buffer and 1 ms one way delay, stepped in microseconds.
+// A windowed (RFC 7440) transfer runs across it, acked at the end of each
+// window, at the first gap, or when the rest of the window stays away.
+struct Result
+{
+    uint64_t usec;
+    uint64_t sent;
+    uint64_t dropped;
+    uint32_t timeouts;
+};
+
+static Result Transfer(bool paced, uint32_t blocks, uint32_t window)
+{
+    enum
+    {
+        PACKET = 1500,
+        BLKSIZE = 1468,
+        NIC_US = PACKET * 8 / 1000,
+        LINK_US = PACKET * 8 / 100,
+        DELAY_US = 1000,
+        BUFFER = 16000,
+        RTO_US = 50000,
+        ACK_TIMEOUT_US = 20000,
+    };
+    struct Pkt
+    {
+        uint32_t block;
+        uint64_t at;
+    };
+
+    TFTPPacer pacer(2000000, PACKET);
+    std::deque<Pkt> nic, wire, queue, toClient, toServer;
+    uint64_t nicBusy = 0, linkBusy = 0;
+    uint32_t queued = 0;
+
+    uint32_t base = 1, next = 1;
+    uint64_t progress = 0;
+    uint32_t expected = 1, count = 0, gapAcked = 0;
+    uint64_t lastData = 0;
+    Result r = {0, 0, 0, 0};
+
+    for (uint64_t now = 0; now < 60000000; now++)
+    {
+        while (!toServer.empty() && toServer.front().at <= now)
+        {
+            uint32_t k = toServer.front().block;
+            toServer.pop_front();
+            if (k + 1 < base)
+                continue;
+            if (paced)
+                pacer.OnAck((uint64_t)(k + 1 - base) * BLKSIZE, now);
+            base = next = k + 1;
+            progress = now;
+        }
+        if (base > blocks)
+        {
+            r.usec = now;
+            break;
+        }
+
+        if (now - progress > RTO_US)
+        {
+            next = base;
+            progress = now;
+            r.timeouts++;
+            if (paced)
+                pacer.OnTimeout();
+        }
+
+        uint32_t end = base + window - 1 < blocks ? base + window - 1 : blocks;
+        while (next <= end)
+        {
+            if (paced && pacer.Delay(PACKET, now))
+                break;
+            if (paced)
+                pacer.OnSend(PACKET, now);
+            Pkt p = {next++, 0};
+            nic.push_back(p);
+        }
+
+        if (nicBusy <= now && !nic.empty())
+        {
+            Pkt p = nic.front();
+            nic.pop_front();
+            nicBusy = now + NIC_US;
+            p.at = nicBusy;
+            wire.push_back(p);
+            r.sent++;
+        }
+        while (!wire.empty() && wire.front().at <= now)
+        {
+            if (queued + PACKET > BUFFER)
+                r.dropped++;
+            else
+            {
+                queue.push_back(wire.front());
+                queued += PACKET;
+            }
+            wire.pop_front();
+        }
+        if (linkBusy <= now && !queue.empty())
+        {
+            Pkt p = queue.front();
+            queue.pop_front();
+            queued -= PACKET;
+            linkBusy = now + LINK_US;
+            p.at = linkBusy + DELAY_US;
+            toClient.push_back(p);
+        }
+
+        while (!toClient.empty() && toClient.front().at <= now)
+        {
+            uint32_t b = toClient.front().block;
+            toClient.pop_front();
+            bool ack = false;
+            lastData = now;
+            if (b == expected)
+            {
+                expected++;
+                ack = ++count >= window || b == blocks;
+            }
+            else if (b > expected && gapAcked != expected)
+            {
+                gapAcked = expected;
+                ack = true;
+            }
+            if (ack)
+            {
+                count = 0;
+                Pkt p = {expected - 1, now + DELAY_US};
+                toServer.push_back(p);
+            }
+        }
+        // the tail of the window is lost, ack what came in order
+        if (count && now - lastData > ACK_TIMEOUT_US)
+        {
+            count = 0;
+            Pkt p = {expected - 1, now + DELAY_US};
+            toServer.push_back(p);
+        }
+    }
+    return r;
+}
+
+static void TestBottleneck()
+{
+    const uint32_t blocks = 2000, window = 32;
+    Result burst = Transfer(false, blocks, window);
+    Result paced = Transfer(true, blocks, window);
+    CHECK(burst.usec && paced.usec);
+
+    double bytes = (double)blocks * 1468;
+    printf("unpaced: %.2f MB/s goodput, %.1f%% loss, %u timeouts\n", bytes / burst.usec,
+           100.0 * burst.dropped / burst.sent, burst.timeouts);
+    printf("paced:   %.2f MB/s goodput, %.1f%% loss, %u timeouts\n", bytes / paced.usec,
+           100.0 * paced.dropped / paced.sent, paced.timeouts);
+
+    CHECK(paced.usec < burst.usec);
+    CHECK(paced.dropped * 10 < burst.dropped);
+}
+
+int main()
+{
+    TestSpacing();
+    TestAckClock();
+    TestCap();
+    TestBottleneck();
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include "msg/TFTPMessages.h"
+#include "net/TFTPPathMtu.h"
+#include "TestCheck.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace oms::msg;
+using namespace oms::net;
+using namespace oms::session;
+
+static void TestSizes()
+{
+    CHECK(TFTPPathMtu::MaxBlkSize(1500, AF_INET) == 1468);
+    CHECK(TFTPPathMtu::MaxBlkSize(1500, AF_INET6) == 1448);
+    CHECK(TFTPPathMtu::MaxBlkSize(65536, AF_INET) == 65464);
+    CHECK(TFTPPathMtu::MaxBlkSize(20, AF_INET) == 8);
+
+    CHECK(TFTPPathMtu::LowerPlateau(65536) == 65535);
+    CHECK(TFTPPathMtu::LowerPlateau(1500) == 1492);
+    CHECK(TFTPPathMtu::LowerPlateau(1400) == 1280);
+    CHECK(TFTPPathMtu::LowerPlateau(576) == 576);
+}
+
+static void TestNegotiate()
+{
+    TFTPOpts req, oack;
+    CHECK(TFTPPathMtu::Negotiate(req, oack, 1500, AF_INET) == 512);
+    CHECK(!oack.contains(TFTP_OPT_BLKSIZE));
+
+    req.insert(TFTP_OPT_BLKSIZE, 65464u);
+    CHECK(TFTPPathMtu::Negotiate(req, oack, 1500, AF_INET) == 1468);
+    CHECK(oack.find(TFTP_OPT_BLKSIZE)->UInt32Value() == 1468);
+
+    req.insert(TFTP_OPT_BLKSIZE, 1024u);
+    CHECK(TFTPPathMtu::Negotiate(req, oack, 9000, AF_INET) == 1024);
+    CHECK(oack.find(TFTP_OPT_BLKSIZE)->UInt32Value() == 1024);
+
+    req.insert(TFTP_OPT_BLKSIZE, "4");
+    CHECK(TFTPPathMtu::Negotiate(req, oack, 1500, AF_INET) < 0);
+    req.insert(TFTP_OPT_BLKSIZE, "1k");
+    CHECK(TFTPPathMtu::Negotiate(req, oack, 1500, AF_INET) < 0);
+}
+
+static void TestCache()
+{
+    TFTPPathMtuCache cache(1000, 2);
+    TFTPEndpoint a = TFTPEndpoint::FromIPv4(inet_addr("10.0.0.1"), htons(5000));
+    TFTPEndpoint a2 = TFTPEndpoint::FromIPv4(inet_addr("10.0.0.1"), htons(5001));
+
+    CHECK(cache.Lookup(a, 9000, 0) == 9000);
+    CHECK(cache.ReportBlackHole(a, 9000, 0) == 8166);
+    // keyed by address, a retry comes from a new port
+    CHECK(cache.Lookup(a2, 9000, 10) == 8166);
+    CHECK(cache.Lookup(a2, 1500, 10) == 1500);
+    // expired: probe the interface MTU again
+    CHECK(cache.Lookup(a2, 9000, 1000) == 9000);
+    CHECK(cache.Size() == 0);
+
+    cache.Update(a, 1400, 0);
+    cache.Update(TFTPEndpoint::FromIPv4(inet_addr("10.0.0.2"), 0), 1400, 0);
+    cache.Update(TFTPEndpoint::FromIPv4(inet_addr("10.0.0.3"), 0), 1400, 0);
+    CHECK(cache.Size() == 2);
+    CHECK(cache.Expire(999) == 0);
+    CHECK(cache.Expire(1000) == 2);
+}
+
+static int UdpSocket(struct sockaddr_in &addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    CHECK(getsockname(fd, (struct sockaddr *)&addr, &len) == 0);
+    return fd;
+}
+
+static int32_t Receive(int fd, uint8_t *buf, uint32_t len, int timeoutMs)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeoutMs) != 1)
+        return -1;
+    return recv(fd, buf, len, 0);
+}
+
+// A link with a reduced MTU emulated in user space on loopback: the relay
+// forwards server datagrams to the client and silently drops those that
+// would not fit linkMtu unfragmented, like a path losing fragments. The
+// server socket is connected to the relay so IP_MTU can be queried.
+struct Link
+{
+    int server, relay, client;
+    struct sockaddr_in serverAddr, relayAddr, clientAddr;
+    uint32_t linkMtu;
+
+    Link(uint32_t mtu) : linkMtu(mtu)
+    {
+        server = UdpSocket(serverAddr);
+        relay = UdpSocket(relayAddr);
+        client = UdpSocket(clientAddr);
+        CHECK(connect(server, (struct sockaddr *)&relayAddr, sizeof(relayAddr)) == 0);
+    }
+    ~Link()
+    {
+        close(server);
+        close(relay);
+        close(client);
+    }
+
+    void Forward()
+    {
+        static uint8_t buf[65536];
+        int32_t n = Receive(relay, buf, sizeof(buf), 50);
+        if (n >= 0 && n + TFTPPathMtu::IPV4_HEADER + TFTPPathMtu::UDP_HEADER <= (int32_t)linkMtu)
+            CHECK(sendto(relay, buf, n, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr)) == n);
+    }
+
+    // server sends DATA blk, returns whether the client acked it
+    bool Send(uint16_t blk, uint8_t *payload, uint16_t len)
+    {
+        static uint8_t wire[65536];
+        TFTPDataMessage data(blk, payload, len);
+        int32_t n = data.Encode(wire, sizeof(wire));
+        CHECK(n == len + 4);
+
+        for (int retry = 0; retry < 3; retry++)
+        {
+            CHECK(send(server, wire, n, 0) == n);
+            Forward();
+
+            int32_t got = Receive(client, wire, sizeof(wire), 20);
+            if (got < 0)
+                continue;
+            TFTPDataMessage in;
+            CHECK(in.Decode(wire, got) == got && in.BlockNumber() == blk && in.BlockDataLength() == len);
+
+            TFTPAckMessage ack(blk);
+            uint8_t ackWire[4];
+            CHECK(ack.Encode(ackWire, sizeof(ackWire)) == 4);
+            // acks are small, the relay passes them back to the server
+            CHECK(sendto(client, ackWire, 4, 0, (struct sockaddr *)&relayAddr, sizeof(relayAddr)) == 4);
+            CHECK(Receive(relay, ackWire, sizeof(ackWire), 1000) == 4);
+            CHECK(sendto(relay, ackWire, 4, 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == 4);
+            CHECK(Receive(server, ackWire, sizeof(ackWire), 1000) == 4);
+            return true;
+        }
+        return false;
+    }
+};
+
+static void TestLoopback()
+{
+    Link link(1500);
+    CHECK(TFTPPathMtu::EnableDiscovery(link.server, AF_INET) == 0);
+    int32_t ifMtu = TFTPPathMtu::Query(link.server, AF_INET);
+    CHECK(ifMtu >= 1500);
+
+    TFTPPathMtuCache cache;
+    TFTPEndpoint peer = TFTPEndpoint::FromSockAddr((struct sockaddr *)&link.clientAddr);
+    static uint8_t file[256 * 1024];
+    memset(file, 0xA5, sizeof(file));
+
+    // the client asks for the largest blksize and retries after each failure
+    int32_t blksize = 0;
+    uint32_t attempts = 0;
+    for (uint64_t now = 0;; now += 1000)
+    {
+        CHECK(++attempts < 20);
+        TFTPRReqMessage rrq("vmlinuz", TFTP_MODE_OCTET);
+        rrq.Opts().insert(TFTP_OPT_BLKSIZE, 65464u);
+
+        uint32_t mtu = cache.Lookup(peer, ifMtu, now);
+        TFTPOAckMessage oack;
+        blksize = TFTPPathMtu::Negotiate(rrq.Opts(), oack.Opts(), mtu, AF_INET);
+        CHECK(blksize >= 512);
+
+        if (link.Send(1, file, blksize))
+            break;
+        cache.ReportBlackHole(peer, mtu, now);
+    }
+
+    // the first plateau that fits, with the largest unfragmented payload
+    CHECK(blksize == 1468);
+    CHECK(attempts > 1);
+
+    // the rest of the file goes through at that size
+    uint32_t off = blksize;
+    for (uint16_t blk = 2; off <= sizeof(file); blk++)
+    {
+        uint32_t n = sizeof(file) - off < (uint32_t)blksize ? sizeof(file) - off : blksize;
+        CHECK(link.Send(blk, file + off, n));
+        off += blksize;
+    }
+}
+
+int main()
+{
+    TestSizes();
+    TestNegotiate();
+    TestCache();
+    TestLoopback();
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "limit/TFTPRateLimiter.h"
+#include "TestCheck.h"
+
+#include <arpa/inet.h>
+
+using namespace oms::limit;
+using namespace oms::session;
+
+static TFTPEndpoint Source(uint32_t addr, uint16_t port)
+{
+    return TFTPEndpoint::FromIPv4(htonl(addr), htons(port));
+}
+
+static void TestBucket()
+{
+    TFTPTokenBucket bucket;
+    bucket.Reset(3, 0);
+    CHECK(bucket.Take() && bucket.Take() && bucket.Take());
+    CHECK(!bucket.Take());
+
+    // 10/s: one token every 100ms
+    bucket.Refill(10, 3, 99);
+    CHECK(!bucket.Take());
+    bucket.Refill(10, 3, 100);
+    CHECK(bucket.Take());
+    CHECK(!bucket.Full(10, 3, 300));
+    CHECK(bucket.Full(10, 3, 400));
+
+    bucket.Refill(10, 3, 100000);
+    CHECK(bucket.Take() && bucket.Take() && bucket.Take() && !bucket.Take());
+}
+
+static void TestFlood()
+{
+    TFTPRateLimiter limiter(10, 5, 1000);
+    TFTPEndpoint good = Source(0x0A000001, 2000);
+
+    // one second of a 100k requests/s flood from rotating ports
+    uint64_t allowed = 0, goodAllowed = 0;
+    for (uint64_t now = 0; now < 1000; now++)
+    {
+        for (int i = 0; i < 100; i++)
+            allowed += limiter.Allow(Source(0xC0A80001, 1024 + i), now);
+        if (now % 200 == 0)
+            goodAllowed += limiter.Allow(good, now);
+    }
+    CHECK(allowed >= 14 && allowed <= 15);
+    CHECK(goodAllowed == 5);
+    CHECK(limiter.Dropped() == 100000 - allowed);
+    CHECK(limiter.Sources() == 2);
+
+    // the well behaved source is back to a full bucket right away, the
+    // flooder once its bucket has filled up after the flood
+    CHECK(limiter.Expire(1000) == 1);
+    CHECK(limiter.Expire(1300) == 0);
+    CHECK(limiter.Expire(1600) == 1);
+    CHECK(limiter.Sources() == 0);
+}
+
+static void TestSpoofedSources()
+{
+    TFTPRateLimiter limiter(10, 2, 100);
+    uint64_t allowed = 0;
+    for (uint32_t i = 0; i < 100000; i++)
+        allowed += limiter.Allow(Source(0x0B000000 + i, 69), 0);
+
+    // 100 tracked sources and the shared overflow bucket
+    CHECK(limiter.Sources() == 100);
+    CHECK(allowed == 100 + 2);
+
+    // tracked sources keep their own budget
+    CHECK(limiter.Allow(Source(0x0B000000, 69), 100));
+}
+
+int main()
+{
+    TestBucket();
+    TestFlood();
+    TestSpoofedSources();
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include "msg/TFTPMessages.h"
+#include "xfer/TFTPResume.h"
+#include "TestCheck.h"
+
+#include <vector>
+
+using namespace oms::msg;
+using namespace oms::xfer;
+
+// Lock-step transfer over a lossy link. A packet is lost with probability
+// lossPct; a block that is not delivered after maxRetries retransmits kills
+// the transfer, as does reaching killAt DATA packets.
+struct Link
+{
+    uint32_t seed;
+    uint32_t lossPct;
+    uint32_t maxRetries;
+    uint64_t killAt;
+    uint64_t sent;
+
+    Link(uint32_t s, uint32_t loss, uint32_t retries) : seed(s), lossPct(loss), maxRetries(retries),
+                                                         killAt(0), sent(0)
+    {
+    }
+    bool Pass()
+    {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % 100 >= lossPct;
+    }
+};
+
+static int TempFile(const std::string &content)
+{
+    FILE *fp = tmpfile();
+    CHECK(fp);
+    int fd = dup(fileno(fp));
+    fclose(fp);
+    CHECK(pwrite(fd, content.data(), content.length(), 0) == (ssize_t)content.length());
+    return fd;
+}
+
+static std::string MakeFile(uint64_t len)
+{
+    std::string s(len, 0);
+    uint32_t seed = 7;
+    for (uint64_t i = 0; i < len; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        s[i] = seed >> 24;
+    }
+    return s;
+}
+
+// Sends blocks [start, ...) of the source until the short block is acked.
+// Returns true when complete, false when the link killed the transfer.
+template <typename Read, typename Write>
+static bool Pump(Link &link, uint64_t start, uint16_t blkSize, Read read, Write write)
+{
+    std::vector<uint8_t> blk(blkSize), wire(blkSize + 4);
+    for (uint64_t i = start;; i++)
+    {
+        int32_t n = read(i, &blk[0]);
+        CHECK(n >= 0 && n <= blkSize);
+
+        TFTPDataMessage data(TFTPResume::BlockNumber(i), &blk[0], n);
+        int32_t len = data.Encode(&wire[0], wire.size());
+        CHECK(len == n + 4);
+
+        bool delivered = false;
+        for (uint32_t retry = 0; retry <= link.maxRetries; retry++)
+        {
+            if (link.killAt && ++link.sent >= link.killAt)
+                return false;
+            if (!link.Pass())
+                continue;
+
+            TFTPDataMessage in;
+            CHECK(in.Decode(&wire[0], len) == len);
+            CHECK(in.BlockNumber() == TFTPResume::BlockNumber(i));
+            // a duplicate is acked again but written once
+            if (!delivered)
+                write(i, in.BlockData(), in.BlockDataLength());
+            delivered = true;
+
+            TFTPAckMessage ack(in.BlockNumber());
+            uint8_t ackWire[4];
+            CHECK(ack.Encode(ackWire, sizeof(ackWire)) == 4);
+            if (!link.Pass())
+                continue;
+
+            TFTPAckMessage ackIn;
+            CHECK(ackIn.Decode(ackWire, sizeof(ackWire)) == 4);
+            CHECK(ackIn.BlockNumber() == TFTPResume::BlockNumber(i));
+            break;
+        }
+        if (!delivered)
+            return false;
+        if (n < blkSize)
+            return true;
+    }
+}
+
+// Client downloads from the server file on fd into local, resuming from what
+// local already holds, which may be counted in blocks of another size.
+static bool Download(Link &link, int fd, uint64_t fileSize, uint16_t blkSize, std::string &local,
+                     uint64_t *resumedAt)
+{
+    uint64_t held = local.length();
+
+    TFTPRReqMessage rrq("image.bin", TFTP_MODE_OCTET);
+    rrq.Opts().insert(TFTP_OPT_BLKSIZE, blkSize);
+    if (held)
+        TFTPResume::Offer(rrq.Opts(), held, TFTPResume::Checksum((const uint8_t *)local.data(), local.length()));
+
+    uint8_t wire[512];
+    int32_t len = rrq.Encode(wire, sizeof(wire));
+    CHECK(len > 0);
+
+    TFTPRReqMessage req;
+    CHECK(req.Decode(wire, len) == len);
+
+    TFTPOAckMessage oack;
+    oack.Opts().insert(TFTP_OPT_BLKSIZE, blkSize);
+    int64_t start = TFTPResume::AcceptRead(req.Opts(), oack.Opts(), fd, fileSize, blkSize);
+    CHECK(start >= 0);
+    len = oack.Encode(wire, sizeof(wire));
+    CHECK(len > 0);
+
+    TFTPOAckMessage oackIn;
+    CHECK(oackIn.Decode(wire, len) == len);
+    int64_t confirmed = TFTPResume::Confirmed(oackIn.Opts(), held, blkSize);
+    CHECK(confirmed == start);
+    local.resize(confirmed * blkSize);
+    if (resumedAt)
+        *resumedAt = confirmed;
+
+    return Pump(
+        link, confirmed, blkSize,
+        [&](uint64_t i, uint8_t *buf) {
+            ssize_t n = pread(fd, buf, blkSize, i * blkSize);
+            return (int32_t)n;
+        },
+        [&](uint64_t i, const uint8_t *data, uint16_t n) {
+            CHECK(local.length() == i * blkSize);
+            local.append((const char *)data, n);
+        });
+}
+
+// Client uploads src to the partial server file on fd.
+static bool Upload(Link &link, const std::string &src, int srcFd, TFTPPrefixCrc &sums, uint16_t blkSize,
+                   bool resume, int64_t *resumedAt)
+{
+    TFTPWReqMessage wrq("image.bin", TFTP_MODE_OCTET);
+    uint64_t offered = src.length();
+    if (resume)
+        TFTPResume::Offer(wrq.Opts(), offered);
+
+    TFTPOAckMessage oack;
+    int64_t start = TFTPResume::AcceptWrite(wrq.Opts(), oack.Opts(), sums, blkSize);
+    CHECK(start >= 0);
+
+    uint8_t wire[512];
+    int32_t len = oack.Encode(wire, sizeof(wire));
+    TFTPOAckMessage oackIn;
+    if (resume)
+        CHECK(len > 0 && oackIn.Decode(wire, len) == len);
+
+    int64_t confirmed = TFTPResume::Confirmed(oackIn.Opts(), offered, srcFd, blkSize);
+    if (resumedAt)
+        *resumedAt = confirmed;
+    if (confirmed < 0)
+        return false;
+
+    return Pump(
+        link, confirmed, blkSize,
+        [&](uint64_t i, uint8_t *buf) {
+            uint64_t off = i * blkSize;
+            uint64_t n = off < src.length() ? src.length() - off : 0;
+            if (n > blkSize)
+                n = blkSize;
+            memcpy(buf, src.data() + off, n);
+            return (int32_t)n;
+        },
+        [&](uint64_t i, const uint8_t *data, uint16_t n) {
+            CHECK(pwrite(sums.Fd(), data, n, i * blkSize) == n);
+        });
+}
+
+static std::string ReadAll(int fd)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    std::string s(size, 0);
+    CHECK(pread(fd, &s[0], size, 0) == size);
+    return s;
+}
+
+static void TestOptions()
+{
+    TFTPOpts req, oack;
+    CHECK(TFTPResume::AcceptRead(req, oack, -1, 0, 512) == 0);
+    CHECK(oack.empty());
+
+    req.insert(TFTP_OPT_RESUME, "12x");
+    CHECK(TFTPResume::AcceptRead(req, oack, -1, 0, 512) < 0);
+    req.insert(TFTP_OPT_RESUME, "-1");
+    CHECK(TFTPResume::AcceptRead(req, oack, -1, 0, 512) < 0);
+
+    // more than the file holds starts over
+    int fd = TempFile(MakeFile(1000));
+    req.insert(TFTP_OPT_RESUME, "1001");
+    req.insert(TFTP_OPT_RESUME_SUM, "0");
+    CHECK(TFTPResume::AcceptRead(req, oack, fd, 1000, 512) == 0);
+    CHECK(!strcmp(oack.find(TFTP_OPT_RESUME)->Value(), "0"));
+
+    // a wrong checksum starts over
+    req.insert(TFTP_OPT_RESUME, "1");
+    CHECK(TFTPResume::AcceptRead(req, oack, fd, 1000, 512) == 0);
+
+    // without rsum the file is not even read
+    TFTPOpts plain;
+    plain.insert(TFTP_OPT_RESUME, "1");
+    CHECK(TFTPResume::AcceptRead(plain, oack, -1, 1000, 512) == 0);
+
+    // no block size to count in, not the Parse() result as an index
+    CHECK(TFTPResume::AcceptRead(plain, oack, -1, 1000, 0) == -1);
+    CHECK(TFTPResume::AcceptRead(req, oack, fd, 1000, 0) == -1);
+    CHECK(TFTPResume::AcceptWrite(plain, oack, fd, 0) == -1);
+
+    // a server confirming more than offered, or part of a block, is rejected
+    TFTPOpts bad;
+    TFTPResume::Offer(bad, 10);
+    CHECK(TFTPResume::Confirmed(bad, 9, 1) < 0);
+    CHECK(TFTPResume::Confirmed(bad, 10, 1) == 10);
+    CHECK(TFTPResume::Confirmed(bad, 10, 5) == 2);
+    CHECK(TFTPResume::Confirmed(bad, 10, 4) < 0);
+    close(fd);
+}
+
+static void TestPrefixCrc()
+{
+    std::string file = MakeFile(3 * TFTPPrefixCrc::STEP + 1000);
+    int fd = TempFile(file);
+    TFTPPrefixCrc sums(fd);
+
+    const uint64_t lens[] = {0, 1, 512, TFTPPrefixCrc::STEP, 2 * TFTPPrefixCrc::STEP + 7,
+                             TFTPPrefixCrc::STEP - 1, file.length()};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+    {
+        uint32_t crc = 0;
+        CHECK(sums.Crc(lens[i], crc) == 0);
+        CHECK(crc == TFTPResume::Checksum((const uint8_t *)file.data(), lens[i], crc32(0L, Z_NULL, 0)));
+    }
+    uint32_t crc = 0;
+    CHECK(sums.Crc(file.length() + 1, crc) < 0);
+
+    // rewritten past the first mark, later marks are recomputed
+    TFTPPrefixCrc partial(fd);
+    CHECK(partial.Crc(file.length(), crc) == 0);
+    file[TFTPPrefixCrc::STEP + 10] ^= 1;
+    CHECK(pwrite(fd, &file[TFTPPrefixCrc::STEP + 10], 1, TFTPPrefixCrc::STEP + 10) == 1);
+    partial.Truncate(TFTPPrefixCrc::STEP + 10);
+    CHECK(partial.Crc(file.length(), crc) == 0);
+    CHECK(crc == TFTPResume::Checksum((const uint8_t *)file.data(), file.length(), crc32(0L, Z_NULL, 0)));
+
+    // the marks answer without the fd
+    TFTPOpts req, oack;
+    TFTPResume::Offer(req, 2048 * 512, TFTPResume::Checksum((const uint8_t *)file.data(), 2048 * 512, crc32(0L, Z_NULL, 0)));
+    close(fd);
+    CHECK(TFTPResume::AcceptRead(req, oack, sums, file.length(), 512) == 2048);
+}
+
+static void TestDownloadUnderLoss(uint64_t fileSize, uint16_t blkSize)
+{
+    std::string file = MakeFile(fileSize);
+    int fd = TempFile(file);
+
+    Link link(42, 30, 2);
+    std::string local;
+    uint32_t attempts = 0;
+    uint64_t resumedAt = 0, lastHeld = 0;
+    while (!Download(link, fd, fileSize, blkSize, local, &resumedAt))
+    {
+        attempts++;
+        CHECK(attempts < 10000);
+        // every attempt after the first picks up where the last one died
+        CHECK(resumedAt == lastHeld);
+        lastHeld = local.length() / blkSize;
+    }
+    CHECK(attempts > 1);
+    CHECK(local == file);
+    close(fd);
+}
+
+static void TestDownloadWrap()
+{
+    // enough 8 byte blocks for the block number to wrap around
+    uint16_t blkSize = 8;
+    std::string file = MakeFile(70000 * 8 + 3);
+    int fd = TempFile(file);
+
+    Link link(1, 0, 0);
+    link.killAt = 66000;
+    std::string local;
+    CHECK(!Download(link, fd, file.length(), blkSize, local, NULL));
+    CHECK(local.length() / blkSize > 65536);
+
+    link.killAt = 0;
+    uint64_t resumedAt = 0;
+    CHECK(Download(link, fd, file.length(), blkSize, local, &resumedAt));
+    CHECK(resumedAt > 65536);
+    CHECK(local == file);
+    close(fd);
+}
+
+// The blksize is renegotiated between attempts, e.g. after a path MTU
+// step-down. The offset still holds, rounded down to whole new blocks.
+static void TestBlkSizeChange()
+{
+    std::string file = MakeFile(1428 * 500 + 11);
+    int fd = TempFile(file);
+
+    Link link(5, 0, 0);
+    link.killAt = 300;
+    std::string local;
+    CHECK(!Download(link, fd, file.length(), 1428, local, NULL));
+    uint64_t held = local.length();
+    CHECK(held == 299 * 1428);
+
+    link.killAt = link.sent + 200;
+    uint64_t resumedAt = 0;
+    CHECK(!Download(link, fd, file.length(), 512, local, &resumedAt));
+    CHECK(resumedAt == held / 512);
+    held = local.length();
+    CHECK(held % 512 == 0 && held > 299 * 1428);
+
+    // and back up, the held bytes end inside a 1428 byte block
+    link.killAt = 0;
+    CHECK(held % 1428);
+    CHECK(Download(link, fd, file.length(), 1428, local, &resumedAt));
+    CHECK(resumedAt == held / 1428);
+    CHECK(local == file);
+
+    // a WRQ counts in bytes as well
+    TFTPOpts wrq, oack;
+    TFTPResume::Offer(wrq, file.length());
+    int part = TempFile(file.substr(0, 1000));
+    CHECK(TFTPResume::AcceptWrite(wrq, oack, part, 512) == 1);
+    CHECK(!strcmp(oack.find(TFTP_OPT_RESUME)->Value(), "512"));
+    close(part);
+    close(fd);
+}
+
+static void TestUploadUnderLoss(uint64_t fileSize, uint16_t blkSize)
+{
+    std::string src = MakeFile(fileSize);
+    int srcFd = TempFile(src);
+    int fd = TempFile("");
+    // kept across attempts like the server keeps it with the partial file
+    TFTPPrefixCrc sums(fd);
+
+    Link link(9, 30, 2);
+    uint32_t attempts = 0;
+    int64_t resumedAt = 0;
+    while (!Upload(link, src, srcFd, sums, blkSize, attempts > 0, &resumedAt))
+    {
+        CHECK(resumedAt >= 0);
+        attempts++;
+        CHECK(attempts < 10000);
+    }
+    CHECK(attempts > 1);
+    CHECK(ReadAll(fd) == src);
+
+    // a damaged partial file is caught by the client and uploaded afresh
+    CHECK(ftruncate(fd, blkSize * 10 + 5) == 0);
+    uint8_t junk = 0x5A;
+    CHECK(pwrite(fd, &junk, 1, blkSize * 3) == 1);
+    sums.Truncate(blkSize * 3);
+
+    Link clean(3, 0, 0);
+    CHECK(!Upload(clean, src, srcFd, sums, blkSize, true, &resumedAt));
+    CHECK(resumedAt < 0);
+    CHECK(ftruncate(fd, 0) == 0);
+    sums.Truncate(0);
+    CHECK(Upload(clean, src, srcFd, sums, blkSize, false, &resumedAt));
+    CHECK(resumedAt == 0);
+    CHECK(ReadAll(fd) == src);
+
+    close(srcFd);
+    close(fd);
+}
+
+int main()
+{
+    TestOptions();
+    TestPrefixCrc();
+    TestDownloadUnderLoss(512 * 300 + 100, 512);
+    TestDownloadUnderLoss(1428 * 200, 1428);
+    TestDownloadWrap();
+    TestBlkSizeChange();
+    TestUploadUnderLoss(512 * 300 + 100, 512);
+    return 0;
+}
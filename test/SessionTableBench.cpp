@@ -0,0 +1,190 @@
+#include "session/TFTPSessionTable.h"
+#include "TestCheck.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+using namespace oms::session;
+
+struct EndpointHash
+{
+    size_t operator()(const TFTPEndpoint &ep) const
+    {
+        return ep.Hash();
+    }
+};
+
+// nanoseconds per operation, best of a few runs
+struct Cost
+{
+    double insert;
+    double hit;
+    double miss;
+    double erase;
+};
+
+static double ElapsedNs(std::chrono::steady_clock::time_point start, size_t ops)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ops;
+}
+
+static void Best(Cost &best, const Cost &c)
+{
+    best.insert = c.insert < best.insert ? c.insert : best.insert;
+    best.hit = c.hit < best.hit ? c.hit : best.hit;
+    best.miss = c.miss < best.miss ? c.miss : best.miss;
+    best.erase = c.erase < best.erase ? c.erase : best.erase;
+}
+
+// Clients are spread over a /16 with a few ports each, lookups come in a
+// random order like packets from many concurrent transfers.
+static void MakeKeys(uint32_t count, std::vector<TFTPEndpoint> &keys, std::vector<TFTPEndpoint> &absent,
+                     std::vector<uint32_t> &order)
+{
+    keys.clear();
+    absent.clear();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        keys.push_back(TFTPEndpoint::FromIPv4(htonl(0x0A000000 | (i >> 2)), htons(1024 + (i & 3))));
+        absent.push_back(TFTPEndpoint::FromIPv4(htonl(0x0B000000 | (i >> 2)), htons(1024 + (i & 3))));
+    }
+    order.resize(count);
+    uint32_t seed = count;
+    for (uint32_t i = 0; i < count; i++)
+        order[i] = i;
+    for (uint32_t i = count - 1; i > 0; i--)
+    {
+        seed = seed * 1103515245 + 12345;
+        std::swap(order[i], order[(seed >> 8) % (i + 1)]);
+    }
+}
+
+static Cost RunTable(const std::vector<TFTPEndpoint> &keys, const std::vector<TFTPEndpoint> &absent,
+                     const std::vector<uint32_t> &order, uint32_t rounds)
+{
+    Cost c;
+    size_t n = keys.size();
+    TFTPSessionTable<> table;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        table.Insert(keys[i])->session = i;
+    c.insert = ElapsedNs(start, n);
+
+    uint64_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+            sum += table.Find(keys[order[i]])->session;
+    }
+    c.hit = ElapsedNs(start, n * rounds);
+    CHECK(sum == (uint64_t)rounds * n * (n - 1) / 2);
+
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        found += table.Find(absent[order[i]]) != NULL;
+    c.miss = ElapsedNs(start, n);
+    CHECK(found == 0);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        CHECK(table.Erase(keys[order[i]]));
+    c.erase = ElapsedNs(start, n);
+    CHECK(table.Size() == 0);
+    return c;
+}
+
+static Cost RunMap(const std::vector<TFTPEndpoint> &keys, const std::vector<TFTPEndpoint> &absent,
+                   const std::vector<uint32_t> &order, uint32_t rounds)
+{
+    Cost c;
+    size_t n = keys.size();
+    std::unordered_map<TFTPEndpoint, TFTPSessionHot, EndpointHash> map;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        map[keys[i]].session = i;
+    c.insert = ElapsedNs(start, n);
+
+    uint64_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+            sum += map.find(keys[order[i]])->second.session;
+    }
+    c.hit = ElapsedNs(start, n * rounds);
+    CHECK(sum == (uint64_t)rounds * n * (n - 1) / 2);
+
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        found += map.count(absent[order[i]]);
+    c.miss = ElapsedNs(start, n);
+    CHECK(found == 0);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        CHECK(map.erase(keys[order[i]]) == 1);
+    c.erase = ElapsedNs(start, n);
+    return c;
+}
+
+// The slowest single insert while growing to 512k slots. Each insert is
+// timed over several runs and the fastest run counts, which filters out
+// scheduler noise but not a stall every run hits at the same insert, like
+// allocating or clearing a whole table.
+static void GrowLatency()
+{
+    const uint32_t count = 300000, runs = 5;
+    std::vector<double> best(count, 1e9);
+    for (uint32_t run = 0; run < runs; run++)
+    {
+        TFTPSessionTable<> table;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            table.Insert(TFTPEndpoint::FromIPv4(htonl(0x0A000000 | (i >> 2)), htons(1024 + (i & 3))));
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            if (us < best[i])
+                best[i] = us;
+        }
+        CHECK(table.Capacity() == 524288);
+    }
+
+    uint32_t worst = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (best[i] > best[worst])
+            worst = i;
+    }
+    printf("slowest insert %.1f us at entry %u\n", best[worst], worst);
+}
+
+int main()
+{
+    const uint32_t sizes[] = {1000, 10000, 100000};
+    std::vector<TFTPEndpoint> keys, absent;
+    std::vector<uint32_t> order;
+
+    printf("%8s %-14s %8s %8s %8s %8s  (ns/op)\n", "entries", "", "insert", "hit", "miss", "erase");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        MakeKeys(sizes[s], keys, absent, order);
+        uint32_t rounds = 2000000 / sizes[s];
+        Cost table = {1e9, 1e9, 1e9, 1e9}, map = table;
+        for (int run = 0; run < 3; run++)
+        {
+            Best(table, RunTable(keys, absent, order, rounds));
+            Best(map, RunMap(keys, absent, order, rounds));
+        }
+        printf("%8u %-14s %8.1f %8.1f %8.1f %8.1f\n", sizes[s], "session table", table.insert, table.hit,
+               table.miss, table.erase);
+        printf("%8u %-14s %8.1f %8.1f %8.1f %8.1f\n", sizes[s], "unordered_map", map.insert, map.hit, map.miss,
+               map.erase);
+    }
+    GrowLatency();
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "session/TFTPSessionTable.h"
+#include "TestCheck.h"
+
+#include <arpa/inet.h>
+#include <map>
+#include <vector>
+
+using namespace oms::session;
+
+static TFTPEndpoint MakeEndpoint(uint32_t i)
+{
+    if (i % 3)
+        return TFTPEndpoint::FromIPv4(htonl(0x0A000000 | (i >> 4)), htons(1024 + (i & 0xF)));
+
+    uint8_t addr[16] = {0x20, 0x01, 0x0d, 0xb8};
+    memcpy(&addr[12], &i, sizeof(i));
+    return TFTPEndpoint::FromIPv6(addr, htons(69));
+}
+
+static void TestEndpoint()
+{
+    struct sockaddr_in in;
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(3000);
+    in.sin_addr.s_addr = inet_addr("192.168.1.7");
+
+    TFTPEndpoint a = TFTPEndpoint::FromSockAddr((const struct sockaddr *)&in);
+    CHECK(a == TFTPEndpoint::FromIPv4(inet_addr("192.168.1.7"), htons(3000)));
+    CHECK(!(a == TFTPEndpoint::FromIPv4(inet_addr("192.168.1.7"), htons(3001))));
+
+    // the mapped address of a real IPv6 socket is a different transfer ID
+    struct sockaddr_in6 in6;
+    memset(&in6, 0, sizeof(in6));
+    in6.sin6_family = AF_INET6;
+    in6.sin6_port = htons(3000);
+    inet_pton(AF_INET6, "::ffff:192.168.1.7", &in6.sin6_addr);
+    CHECK(!(a == TFTPEndpoint::FromSockAddr((const struct sockaddr *)&in6)));
+}
+
+// random operations checked against std::map, across several grows
+static void TestAgainstMap(uint32_t keys, uint32_t ops)
+{
+    TFTPSessionTable<> table;
+    std::map<uint32_t, uint64_t> ref;
+    uint32_t seed = keys;
+    bool migrated = false;
+
+    for (uint32_t n = 0; n < ops; n++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t i = (seed >> 8) % keys;
+        TFTPEndpoint ep = MakeEndpoint(i);
+
+        switch ((seed >> 4) % 4)
+        {
+        case 0:
+        case 1:
+        {
+            bool inserted = false;
+            TFTPSessionHot *hot = table.Insert(ep, &inserted);
+            CHECK(hot);
+            CHECK(inserted == !ref.count(i));
+            if (inserted)
+                CHECK(hot->nextBlock == 0 && hot->windowSize == 1);
+            hot->nextBlock = n;
+            hot->session = i;
+            ref[i] = n;
+            break;
+        }
+        case 2:
+            CHECK(table.Erase(ep) == (ref.erase(i) > 0));
+            break;
+        default:
+        {
+            TFTPSessionHot *hot = table.Find(ep);
+            std::map<uint32_t, uint64_t>::iterator it = ref.find(i);
+            CHECK((hot != NULL) == (it != ref.end()));
+            if (hot)
+                CHECK(hot->nextBlock == it->second && hot->session == i);
+            break;
+        }
+        }
+        migrated |= table.Migrating();
+        CHECK(table.Size() == ref.size());
+    }
+    CHECK(migrated);
+
+    for (std::map<uint32_t, uint64_t>::iterator it = ref.begin(); it != ref.end(); it++)
+    {
+        TFTPSessionHot *hot = table.Find(MakeEndpoint(it->first));
+        CHECK(hot && hot->nextBlock == it->second);
+    }
+
+    size_t visited = 0;
+    table.ForEach([&](const TFTPEndpoint &, TFTPSessionHot &hot) {
+        CHECK(ref.count(hot.session));
+        visited++;
+    });
+    CHECK(visited == ref.size());
+}
+
+static void TestGrowIsIncremental()
+{
+    TFTPSessionTable<> table;
+    for (uint32_t i = 0; i < 100000; i++)
+        CHECK(table.Insert(MakeEndpoint(i)));
+
+    size_t capacity = table.Capacity();
+    uint32_t i = 100000;
+    while (table.Capacity() == capacity)
+        table.Insert(MakeEndpoint(i++));
+
+    // old entries are still reachable while the migration is in progress
+    CHECK(table.Migrating());
+    for (uint32_t j = 0; j < i; j += 97)
+        CHECK(table.Find(MakeEndpoint(j)));
+
+    while (table.Migrating())
+        table.Insert(MakeEndpoint(i++));
+    CHECK(table.Size() == i);
+    for (uint32_t j = 0; j < i; j++)
+        CHECK(table.Find(MakeEndpoint(j)));
+}
+
+// Every step of a migration trims the migrated part of the old table.
+// Entries past the cursor may have their home slot in a trimmed page, so
+// all of them must stay reachable after each step, not only at the end.
+static void TestFindDuringMigration()
+{
+    TFTPSessionTable<> table;
+    uint32_t i = 0;
+    while (table.Capacity() < 32768 || table.Migrating())
+    {
+        CHECK(table.Insert(MakeEndpoint(i++)));
+        if (!table.Migrating())
+            continue;
+        for (uint32_t j = 0; j < i; j++)
+            CHECK(table.Find(MakeEndpoint(j)));
+    }
+    CHECK(table.Size() == i);
+}
+
+int main()
+{
+    TestEndpoint();
+    TestAgainstMap(1000, 200000);
+    TestAgainstMap(10000, 400000);
+    TestAgainstMap(100000, 1000000);
+    TestGrowIsIncremental();
+    TestFindDuringMigration();
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "timer/TFTPTimerWheel.h"
+#include "TestCheck.h"
+
+#include <chrono>
+#include <map>
+#include <vector>
+
+using namespace oms::timer;
+
+// 100k transfers, each with a retransmit timer moved by every ACK. Ticks
+// are milliseconds and retransmits are due 1 to 3 seconds out. One in ten
+// clients has stalled and only ever retransmits, the rest are moved long
+// before they fire.
+static const uint32_t SESSIONS = 100000;
+static const uint32_t ACTIVE = SESSIONS - SESSIONS / 10;
+static const uint32_t TICKS = 2000;
+static const uint32_t ACKS_PER_TICK = 500;
+
+struct Rate
+{
+    double arm;
+    double rearm;
+    double cancel;
+    uint64_t fired;
+};
+
+static double Mops(std::chrono::steady_clock::time_point start, uint64_t ops)
+{
+    return ops / std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint64_t Delay(uint32_t &seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return 1000 + (seed >> 8) % 2000;
+}
+
+static Rate RunWheel()
+{
+    Rate r;
+    TFTPTimerWheel wheel(0);
+    std::vector<uint32_t> handle(SESSIONS);
+    uint32_t seed = 1;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < SESSIONS; i++)
+        handle[i] = wheel.Arm(Delay(seed), i);
+    r.arm = Mops(start, SESSIONS);
+
+    // an expired transfer retransmits and arms again
+    r.fired = 0;
+    uint64_t acks = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t now = 1; now <= TICKS; now++)
+    {
+        for (uint32_t a = 0; a < ACKS_PER_TICK; a++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t i = (seed >> 8) % ACTIVE;
+            wheel.Rearm(handle[i], now + Delay(seed));
+            acks++;
+        }
+        wheel.Advance(now, [&](uint32_t, uint64_t i) {
+            r.fired++;
+            handle[i] = wheel.Arm(now + Delay(seed), i);
+        });
+    }
+    r.rearm = Mops(start, acks + r.fired);
+    CHECK(wheel.Pending() == SESSIONS);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < SESSIONS; i++)
+        CHECK(wheel.Cancel(handle[i]));
+    r.cancel = Mops(start, SESSIONS);
+    CHECK(wheel.Pending() == 0);
+    return r;
+}
+
+// the usual alternative, an ordered multimap with iterators as handles
+static Rate RunMultimap()
+{
+    typedef std::multimap<uint64_t, uint32_t> Timers;
+    Rate r;
+    Timers timers;
+    std::vector<Timers::iterator> handle(SESSIONS);
+    uint32_t seed = 1;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < SESSIONS; i++)
+        handle[i] = timers.insert(std::make_pair(Delay(seed), i));
+    r.arm = Mops(start, SESSIONS);
+
+    r.fired = 0;
+    uint64_t acks = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t now = 1; now <= TICKS; now++)
+    {
+        for (uint32_t a = 0; a < ACKS_PER_TICK; a++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t i = (seed >> 8) % ACTIVE;
+            timers.erase(handle[i]);
+            handle[i] = timers.insert(std::make_pair(now + Delay(seed), i));
+            acks++;
+        }
+        while (!timers.empty() && timers.begin()->first <= now)
+        {
+            uint32_t i = timers.begin()->second;
+            timers.erase(timers.begin());
+            r.fired++;
+            handle[i] = timers.insert(std::make_pair(now + Delay(seed), i));
+        }
+    }
+    r.rearm = Mops(start, acks + r.fired);
+    CHECK(timers.size() == SESSIONS);
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < SESSIONS; i++)
+        timers.erase(handle[i]);
+    r.cancel = Mops(start, SESSIONS);
+    CHECK(timers.empty());
+    return r;
+}
+
+int main()
+{
+    Rate wheel = {0, 0, 0, 0}, map = wheel;
+    for (int run = 0; run < 3; run++)
+    {
+        Rate w = RunWheel(), m = RunMultimap();
+        if (w.rearm > wheel.rearm)
+            wheel = w;
+        if (m.rearm > map.rearm)
+            map = m;
+    }
+    printf("%u timers, %u ticks, %u acks per tick (Mops/s)\n", SESSIONS, TICKS, ACKS_PER_TICK);
+    printf("wheel:    arm %6.2f, rearm/fire %6.2f, cancel %6.2f, %llu fired\n", wheel.arm, wheel.rearm,
+           wheel.cancel, (unsigned long long)wheel.fired);
+    printf("multimap: arm %6.2f, rearm/fire %6.2f, cancel %6.2f, %llu fired\n", map.arm, map.rearm, map.cancel,
+           (unsigned long long)map.fired);
+
+    CHECK(wheel.fired > SESSIONS / 50 && map.fired > SESSIONS / 50);
+    return 0;
+}
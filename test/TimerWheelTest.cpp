@@ -0,0 +1,186 @@
+#include "timer/TFTPTimerWheel.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <vector>
+
+using namespace oms::timer;
+
+// Reference: a binary heap with lazy deletion, entries are (expires, key,
+// version) and only the latest version of a key is live.
+struct Reference
+{
+    typedef std::pair<uint64_t, std::pair<uint64_t, uint64_t> > entry;
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry> > heap;
+    std::map<uint64_t, uint64_t> version;
+
+    void Arm(uint64_t key, uint64_t expires)
+    {
+        heap.push(entry(expires, std::make_pair(key, ++version[key])));
+    }
+    void Cancel(uint64_t key)
+    {
+        ++version[key];
+    }
+    std::vector<uint64_t> Advance(uint64_t now)
+    {
+        std::vector<uint64_t> fired;
+        while (!heap.empty() && heap.top().first <= now)
+        {
+            entry e = heap.top();
+            heap.pop();
+            if (version[e.second.first] == e.second.second)
+            {
+                fired.push_back(e.second.first);
+                ++version[e.second.first];
+            }
+        }
+        return fired;
+    }
+};
+
+static uint64_t Delay(uint32_t r)
+{
+    // mostly retransmit sized, some long expiry timers and a few beyond
+    // the top level of the wheel
+    switch (r % 16)
+    {
+    case 0:
+        return 0;
+    case 1:
+        return (uint64_t)(r >> 4) << 14;
+    case 2:
+        return (uint64_t)(r >> 4) << 20;
+    case 3:
+        return 5000000000ull + (r >> 4);
+    default:
+        return (r >> 4) % 3000;
+    }
+}
+
+static void TestAgainstReference(uint64_t start, uint32_t keys, uint32_t steps)
+{
+    TFTPTimerWheel wheel(start);
+    Reference ref;
+    std::vector<uint32_t> handle(keys, 0);
+    uint64_t now = start;
+    uint32_t seed = keys;
+    size_t total = 0;
+
+    for (uint32_t step = 0; step < steps; step++)
+    {
+        for (int op = 0; op < 8; op++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t key = (seed >> 8) % keys;
+            seed = seed * 1103515245 + 12345;
+            uint64_t expires = now + Delay(seed >> 2);
+
+            if (!handle[key])
+            {
+                handle[key] = wheel.Arm(expires, key);
+                ref.Arm(key, expires);
+            }
+            else if (seed & 1)
+            {
+                CHECK(wheel.Rearm(handle[key], expires));
+                CHECK(wheel.Expires(handle[key]) == expires);
+                ref.Arm(key, expires);
+            }
+            else
+            {
+                CHECK(wheel.Cancel(handle[key]));
+                handle[key] = 0;
+                ref.Cancel(key);
+            }
+        }
+
+        seed = seed * 1103515245 + 12345;
+        // mostly single ticks, sometimes a long idle gap
+        now += (seed >> 20) % 64 ? 1 : (seed >> 8) % 100000;
+
+        std::vector<uint64_t> fired;
+        wheel.Advance(now, [&](uint32_t id, uint64_t key) {
+            CHECK(handle[key] == id);
+            handle[key] = 0;
+            fired.push_back(key);
+        });
+        std::vector<uint64_t> expected = ref.Advance(now);
+        std::sort(fired.begin(), fired.end());
+        std::sort(expected.begin(), expected.end());
+        CHECK(fired == expected);
+        total += fired.size();
+    }
+    CHECK(total > steps);
+    CHECK(wheel.Pending() == (size_t)std::count_if(handle.begin(), handle.end(),
+                                                      [](uint32_t h) { return h != 0; }));
+}
+
+static void TestRearmFromCallback()
+{
+    TFTPTimerWheel wheel(10);
+    uint32_t id = wheel.Arm(12, 1);
+    CHECK(id);
+
+    std::vector<uint64_t> at;
+    for (uint64_t now = 10; now < 2000; now++)
+    {
+        wheel.Advance(now, [&](uint32_t, uint64_t data) {
+            at.push_back(now);
+            // a periodic timer, and one already due which runs on the next tick
+            if (data == 1)
+                wheel.Arm(now + 255, 1);
+            if (data == 1 && at.size() == 2)
+                wheel.Arm(now - 5, 2);
+        });
+    }
+    CHECK(at.size() == 9);
+    CHECK(at[0] == 12 && at[1] == 267 && at[2] == 268 && at[3] == 522);
+}
+
+static void TestFarFuture()
+{
+    TFTPTimerWheel wheel((1ull << 40) - 3);
+    uint64_t expires = (1ull << 40) + (1ull << 33) + 7;
+    wheel.Arm(expires, 0);
+
+    uint64_t firedAt = 0;
+    for (uint64_t now = (1ull << 40); !firedAt; now += 1 << 12)
+    {
+        CHECK(now <= expires + (1 << 12));
+        wheel.Advance(now, [&](uint32_t, uint64_t) { firedAt = now; });
+    }
+    CHECK(firedAt >= expires && firedAt < expires + (1 << 12));
+}
+
+static void TestStaleHandle()
+{
+    TFTPTimerWheel wheel(0);
+    uint32_t first = wheel.Arm(1, 1);
+    wheel.Advance(1, [](uint32_t, uint64_t) {});
+    CHECK(!wheel.Armed(first));
+
+    // the node is reused at once, the old handle must not reach it
+    uint32_t second = wheel.Arm(100, 2);
+    CHECK(second != first && wheel.Armed(second));
+    CHECK(!wheel.Cancel(first));
+    CHECK(!wheel.Rearm(first, 5));
+    CHECK(wheel.Expires(second) == 100);
+
+    CHECK(wheel.Cancel(second));
+    uint32_t third = wheel.Arm(100, 3);
+    CHECK(!wheel.Cancel(second) && wheel.Armed(third));
+}
+
+int main()
+{
+    TestAgainstReference(0, 100, 20000);
+    TestAgainstReference(250, 1000, 20000);
+    TestAgainstReference((1ull << 32) - 100, 100000, 5000);
+    TestRearmFromCallback();
+    TestFarFuture();
+    TestStaleHandle();
+    return 0;
+}